@@ -1,4 +1,4 @@
-# Try to find the ffmpeg libraries and headers for avcodec avformat swscale
+# Try to find the ffmpeg libraries and headers for avcodec avformat swscale swresample
 #
 # FFMPEG_INCLUDE_DIRS
 # FFMPEG_LIBRARIES
@@ -21,6 +21,10 @@ FIND_PATH(
   SWSCALE_INCLUDE_DIR libswscale/swscale.h
   /usr/include /usr/local/include /opt/local/include
 )
+FIND_PATH(
+  SWRESAMPLE_INCLUDE_DIR libswresample/swresample.h
+  /usr/include /usr/local/include /opt/local/include
+)
 
 # Find Library files
 FIND_LIBRARY(
@@ -43,15 +47,20 @@ FIND_LIBRARY(
   NAMES swscale
   PATH /usr/lib /usr/local/lib /opt/local/lib
 )
+FIND_LIBRARY(
+  SWRESAMPLE_LIBRARY
+  NAMES swresample
+  PATH /usr/lib /usr/local/lib /opt/local/lib
+)
 
 IF( EXISTS "${AVUTIL_INCLUDE_DIR}/libavutil/pixdesc.h" )
   SET( AVUTIL_HAVE_PIXDESC TRUE)
 endif()
 
-IF(AVCODEC_INCLUDE_DIR AND AVFORMAT_INCLUDE_DIR AND AVUTIL_INCLUDE_DIR AND SWSCALE_INCLUDE_DIR AND AVCODEC_LIBRARY AND AVFORMAT_LIBRARY AND AVUTIL_LIBRARY AND SWSCALE_LIBRARY AND AVUTIL_HAVE_PIXDESC)
+IF(AVCODEC_INCLUDE_DIR AND AVFORMAT_INCLUDE_DIR AND AVUTIL_INCLUDE_DIR AND SWSCALE_INCLUDE_DIR AND SWRESAMPLE_INCLUDE_DIR AND AVCODEC_LIBRARY AND AVFORMAT_LIBRARY AND AVUTIL_LIBRARY AND SWSCALE_LIBRARY AND SWRESAMPLE_LIBRARY AND AVUTIL_HAVE_PIXDESC)
    SET(FFMPEG_FOUND TRUE)
-   SET(FFMPEG_LIBRARIES ${AVCODEC_LIBRARY} ${AVFORMAT_LIBRARY} ${AVUTIL_LIBRARY} ${SWSCALE_LIBRARY})
-   SET(FFMPEG_INCLUDE_DIRS ${AVCODEC_INCLUDE_DIR} ${AVFORMAT_INCLUDE_DIR} ${AVUTIL_INCLUDE_DIR} ${SWSCALE_INCLUDE_DIR})
+   SET(FFMPEG_LIBRARIES ${AVCODEC_LIBRARY} ${AVFORMAT_LIBRARY} ${AVUTIL_LIBRARY} ${SWSCALE_LIBRARY} ${SWRESAMPLE_LIBRARY})
+   SET(FFMPEG_INCLUDE_DIRS ${AVCODEC_INCLUDE_DIR} ${AVFORMAT_INCLUDE_DIR} ${AVUTIL_INCLUDE_DIR} ${SWSCALE_INCLUDE_DIR} ${SWRESAMPLE_INCLUDE_DIR})
 
    include(CheckCXXSourceCompiles)
 
@@ -0,0 +1,71 @@
+#ifndef AUDIOCORRELATOR_H
+#define AUDIOCORRELATOR_H
+
+#include <limits>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+using namespace std;
+using namespace cv;
+
+// Alignment of audio samples to reference samples.
+struct AudioAlignment
+{
+    // Number of samples the reference lags behind, so sample t of audio matches sample t + lag of reference.
+    int lag;
+    // Height of correlation peak above the mean of sidelobes in their standard deviations, measured on the
+    // coarsest level. Peaks scoring below about 5 hardly stand out of noise, so the lag is not reliable.
+    double peak_to_sidelobe;
+};
+
+// Finds lags of audio tracks against one reference by cross-correlation, coarse to fine. Signals are
+// decimated into levels, each a quarter of the rate of the one above, until reaching coarse rate. Lags in
+// the whole search range are correlated at once on the coarsest level through DFT, with the reference
+// spectrum computed once for all tracks, and the peak is then refined level by level within a few samples
+// by direct correlation, down to sample accuracy at full rate.
+class AudioCorrelator
+{
+public:
+    // Prepares reference samples, a row of CV_32FC1 at sample rate, for lags up to max lag samples either way.
+    AudioCorrelator ( const Mat& reference_samples, const int max_lag, const double sample_rate,
+                      const double coarse_rate = 1000.0 );
+
+    // Returns alignment of audio samples, a row of CV_32FC1 at sample rate of reference. Samples beyond
+    // the length of reference are ignored.
+    AudioAlignment Align ( const Mat& samples ) const;
+
+    // Returns height of peak of correlation, a row of CV_32FC1, above the mean of the other values in their standard
+    // deviations. Values within peak half width of the peak belong to the peak itself and are left out.
+    static double MeasurePeakToSidelobe ( const Mat& correlation, const int peak_index, const int peak_half_width );
+
+    // Returns number of levels including full rate.
+    int GetLevelCount() const
+    {
+        return _reference_levels.size();
+    }
+
+private:
+    // Returns samples averaged over blocks of factor samples, dropping the last partial block.
+    static Mat Decimate ( const Mat& samples, const int factor );
+
+    // Returns correlation of reference and samples at lag, over the samples they overlap.
+    static double Correlate ( const Mat& reference, const Mat& samples, const int lag );
+
+    // Returns largest lag searched at level.
+    int GetMaxLag ( const int level ) const;
+
+    // Reference at each level, from full rate to the coarsest.
+    vector<Mat> _reference_levels;
+    // Spectrum of the coarsest reference zero padded to DFT size, in CCS packed format.
+    Mat _reference_spectrum;
+    // Length of DFT, covering reference and the largest lag without wrapping around.
+    int _dft_size;
+    int _max_lag;
+    // Ratio of sample rates of neighbouring levels.
+    static const int kLevelFactor = 4;
+    // Number of lags on each side of the peak left out of sidelobes.
+    static const int kPeakHalfWidth = 5;
+};
+
+#endif // AUDIOCORRELATOR_H
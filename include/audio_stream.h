@@ -0,0 +1,72 @@
+#ifndef AUDIOSTREAM_H
+#define AUDIOSTREAM_H
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "demuxer.h"
+
+extern "C"{
+    #include "libavcodec/avcodec.h"
+    #include "libavutil/avutil.h"
+    #include "libswresample/swresample.h"
+}
+
+using namespace std;
+
+// Decodes the audio stream of a file with libavcodec, reading packets from a demuxer which may be shared
+// with the video decoder, and reads it piece by piece as mono float samples resampled by libswresample,
+// whatever sample format and channel layout the codec decodes to.
+class AudioStream
+{
+public:
+    AudioStream() {}
+    ~AudioStream();
+
+    // Opens the best audio stream of the demuxer, resampled to sample rate, 0 for the native rate of the stream.
+    bool Open ( const shared_ptr<Demuxer>& demuxer, const int sample_rate );
+
+    void Close();
+
+    bool IsOpened() const
+    {
+        return _swr_context != NULL;
+    }
+
+    // Reads the next count samples. Resampled frames are written straight into samples when they fit, and
+    // kept for the next read otherwise. Returns number of samples read, less than count only at the end of stream.
+    int Read ( float* samples, const int count );
+
+    // Returns rate of samples read.
+    int GetSampleRate() const
+    {
+        return _sample_rate;
+    }
+
+private:
+    // Non-copyable, as it owns FFmpeg contexts.
+    AudioStream ( const AudioStream& );
+    AudioStream& operator= ( const AudioStream& );
+
+    // Decodes the next frame. Returns false at the end of stream.
+    bool DecodeFrame();
+
+    shared_ptr<Demuxer> _demuxer;
+    AVCodecContext* _codec_context = NULL;
+    SwrContext* _swr_context = NULL;
+    AVFrame* _frame = NULL;
+    AVPacket* _packet = NULL;
+    int _stream_index = -1;
+    int _sample_rate = 0;
+    // Whether end of file was reached and decoder is being drained.
+    bool _draining = false;
+    // Whether samples delayed in resampler were flushed at the end of stream.
+    bool _flushed = false;
+    // Resampled samples which didn't fit in the last read, handed out from pending begin.
+    vector<float> _pending_samples;
+    size_t _pending_begin = 0;
+};
+
+#endif // AUDIOSTREAM_H
@@ -0,0 +1,34 @@
+#ifndef BLENDKERNEL_H
+#define BLENDKERNEL_H
+
+#include "opencv2/opencv.hpp"
+
+using namespace cv;
+
+class BlendKernel
+{
+public:
+    // Number of fractional bits of the fixed-point blending weights.
+    static const int kWeightBits = 8;
+
+    // Quantizes blending factor in [0, 1] to fixed-point weight in [0, 1 << kWeightBits].
+    static ushort QuantizeWeight ( const double factor );
+
+    // Accumulates weighted source bytes on canvas bytes, one weight per byte:
+    // dst[i] = saturate(dst[i] + ((src[i] * weights[i] + half) >> kWeightBits)).
+    // The fastest implementation supported by the running cpu is selected at the first call,
+    // and all implementations produce identical results.
+    static void AccumulateRow ( const uchar* src, const ushort* weights, uchar* dst, const int count );
+
+private:
+    typedef void ( *AccumulateRowFunction ) ( const uchar*, const ushort*, uchar*, const int );
+
+    // Returns the implementation matching the running cpu.
+    static AccumulateRowFunction SelectAccumulateRow();
+
+    static void AccumulateRowScalar ( const uchar* src, const ushort* weights, uchar* dst, const int count );
+    static void AccumulateRowSse41 ( const uchar* src, const ushort* weights, uchar* dst, const int count );
+    static void AccumulateRowAvx2 ( const uchar* src, const ushort* weights, uchar* dst, const int count );
+};
+
+#endif // BLENDKERNEL_H
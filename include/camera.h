@@ -20,6 +20,13 @@ public:
   // Convert 3d points (N x 3) in world to 2d points (N x 2) on frame. 
   Mat ProjectWorldToFrame(const Mat& world_pts, const bool debug) const;
   
+  // Convert count 3d points in world (x, y, z interleaved) to 2d points on frame (x, y interleaved)
+  // in caller owned buffer, without any allocation. Points behind camera get the max double value.
+  void ProjectWorldToFrame(const double* world_pts, const int count, double* frame_pts) const;
+  
+  // Convert 2d point on frame to the unit direction of its ray in world, inverse of ProjectWorldToFrame.
+  Point3d ProjectFrameToWorld(const Point2d& frame_pt) const;
+  
   // Returns the camera center as Point2d.
   Point2d GetCameraCenter() const { return Point2d(_u0, _v0); }
   
@@ -28,9 +35,12 @@ public:
   
   string GetName() const { return _name; }
   
+  // Returns hash of all intrinsic and extrinsic parameters.
+  uint64_t GetParameterHash() const;
+  
 private:
-  // Convert 3d point in camera coordinate system to 2d point in frame.
-  Mat ProjectCameraToFrame(const Mat& camera_pt) const;
+  // Solves the angle of ray to xy plane in camera coordinates system from its distance to center on frame.
+  double SolveThetaFromRho(const double rho) const;
   
   string _name;
   int _width, _height;
@@ -39,6 +49,9 @@ private:
   vector<double> _poly;
   vector<double> _inverse_poly;
   Mat _transform_4_4;
+  // Row-major rotation from camera to world, and its inverse.
+  double _rotation[9];
+  double _inverse_rotation[9];
 };
 
 #endif // CAMERA_H
@@ -0,0 +1,99 @@
+#ifndef CANVASGATHERER_H
+#define CANVASGATHERER_H
+
+#include <vector>
+
+#include "frame_mapper.h"
+#include "blend_kernel.h"
+
+#include "opencv2/opencv.hpp"
+
+using namespace std;
+using namespace cv;
+
+// Ways a run of canvas pixels is gathered from frames.
+enum GatherKind
+{
+    // No camera covers the pixels, which are cleared.
+    GATHER_KIND_UNCOVERED,
+    // One camera covers the pixels alone, which are copied from its frame.
+    GATHER_KIND_COPY,
+    // Several cameras contribute to each pixel, which is blended from their frames.
+    GATHER_KIND_BLEND
+};
+
+// Run of consecutive canvas pixels in one row gathered the same way.
+struct GatherSpan
+{
+    // Offset of the first pixel of the run in canvas.
+    int canvas_offset;
+    // Number of pixels in the run.
+    int pixel_count;
+    GatherKind kind;
+    // Camera of copied run.
+    int camera_index;
+    // Index of the first pixel of the run in copy sources or blended pixels.
+    int first_index;
+};
+
+// Paints canvas from the frames of all cameras at once, each canvas pixel gathering from its own list of
+// contributing cameras. Copied and uncovered pixels are written exactly once, and blended pixels are
+// accumulated with the blend kernel. The result equals painting the frame mappers one after another on a
+// cleared canvas, without clearing the whole canvas first.
+class CanvasGatherer
+{
+public:
+    CanvasGatherer() {}
+    // Merges normalized frame mappers of all cameras, in the order of frames painted later.
+    explicit CanvasGatherer(const vector<const FrameMapper*>& frame_mappers);
+
+    // Paints canvas rows in [row_begin, row_end) from frames of all cameras, where empty frames contribute
+    // fill value at their weight and uncovered pixels get fill value. Frames and canvas are either all BGR or all single planes,
+    // as painting the chroma planes of YUV frames with chroma mappers. Painting disjoint row ranges from
+    // several threads at once gives the same canvas.
+    void PaintOnCanvas(const vector<Mat>& frames, Mat* canvas, const int row_begin, const int row_end,
+                       const uchar fill_value = 0) const;
+
+    // Returns size of output canvas.
+    Size GetOutputSize() const
+    {
+        return _output_size;
+    }
+
+    // Returns size of frames of each camera.
+    const vector<Size>& GetFrameSizes() const
+    {
+        return _frame_sizes;
+    }
+
+private:
+    // Weight of contributions copied instead of blended.
+    static const ushort kCopyWeight = 0xFFFF;
+
+    // Paints frames of given number of 8-bit channels.
+    template<int channels>
+    void PaintPixels(const vector<Mat>& frames, Mat* canvas, const int row_begin, const int row_end,
+                     const uchar fill_value) const;
+
+    // Size of output canvas.
+    Size _output_size;
+    // Size of frames of each camera.
+    vector<Size> _frame_sizes;
+    // Runs of canvas pixels in canvas order, covering every canvas pixel.
+    vector<GatherSpan> _spans;
+    // Index of the first span of each canvas row, with one extra element for the end of the last row.
+    vector<int> _span_row_begins;
+    // Source pixels on frame of copied canvas pixels, ordered as in spans.
+    vector<short> _copy_xs;
+    vector<short> _copy_ys;
+    // Index of the first contribution of each blended canvas pixel, with one extra element for the end.
+    vector<int> _blend_pixel_begins;
+    // Contributions to blended canvas pixels in camera order: camera, source pixel on frame and
+    // fixed-point weight, or copy weight for a source pixel replacing earlier contributions.
+    vector<int> _contribution_cameras;
+    vector<short> _contribution_xs;
+    vector<short> _contribution_ys;
+    vector<ushort> _contribution_weights;
+};
+
+#endif // CANVASGATHERER_H
@@ -3,9 +3,11 @@
 
 #include <iostream>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "utils.h"
+#include "audio_correlator.h"
 #include "video_clip.h"
 #include "synch_parameters.h"
 
@@ -25,26 +27,77 @@ public:
     static void ReadSynchParametersFromFile ( const string& file_name, SynchParameters* parameters );
 
     // Saves synchronization result including video locations, recording camera names, and time offset in seconds.
-    void SaveSynchronizationResult ( const string& file_name );
+    // Returns false if file cannot be opened for writing.
+    bool SaveSynchronizationResult ( const string& file_name );
     
     // Creates video clips from the filenames with camera names.
     // Video files will be verified. If any file doesn't exist, it will exit exceptionally.
     void LoadVideosWithFileNames ( const bool synchronized = false );
 
-    // Synchronizes video clips based on audio samples in a certain range of time.
+    // Synchronizes video clips based on audio samples in a certain range of time, extracted from all videos at once.
     // The maximum time shift between the first and last video clips is no more than the window.
-    void SynchronizeVideoWithAudio ();
+    // With a cache folder, the result is saved there and reused by later runs on the same video files,
+    // identified by path, size, modification time and leading bytes, which then skip synchronization.
+    void SynchronizeVideoWithAudio ( const string& cache_folder = "" );
+
+    // Loads time offsets from synchronization result saved for the same videos and camera names.
+    // Returns false if file doesn't exist, is for other videos, or is malformed.
+    bool LoadSynchronizationResult ( const string& file_name );
 
     // Reads synchronized frames from each video and stores them in a vector.
     // If the video has not started or finished, the frame return will be empty.
     // If videos has not been synchronized, it will exit exceptionally.
-    vector<Mat> ReadFramesVector ( const double global_time, const bool to_gray );
+    // Frames are read and converted into buffers reused by every read, so they are valid until the next read.
+    void ReadFramesVector ( const double global_time, const bool to_gray, vector<Mat>* frames );
+
+    // Reads synchronized frames from each video as Y, U and V planes of YUV 4:2:0.
+    // If the video has not started or finished, its planes will be empty.
+    vector<vector<Mat>> ReadPlanesVector ( const double global_time );
+
+    // Sets how video clips read frames at increasing times, applied to clips already loaded and loaded afterwards.
+    void SetReadMode ( const ReadMode read_mode )
+    {
+        read_mode_ = read_mode;
+        for ( VideoClip& video_clip : video_clip_vector_ )
+        {
+            video_clip.SetReadMode ( read_mode );
+        }
+    }
+
+    // Sets rate in Hz that audio is resampled to for synchronization, 0 for the native rate of the first
+    // video, which audio of all videos is resampled to.
+    // Low rates keep enough detail for correlation while cutting its input and memory.
+    void SetAudioSampleRate ( const int audio_sample_rate )
+    {
+        audio_sample_rate_ = audio_sample_rate;
+    }
+
+    // Sets whether clock drift of each video is followed over the whole video after synchronization, so
+    // their shifts vary with time instead of staying constant.
+    void SetDriftTracking ( const bool track_drift )
+    {
+        track_drift_ = track_drift;
+    }
+
+    // Sets library decoding frames of video clips loaded afterwards. Decode thread count is the total
+    // number of FFmpeg decoding threads shared evenly by all clips, 0 for all hardware threads.
+    void SetDecodeBackend ( const DecodeBackend decode_backend, const int decode_thread_count )
+    {
+        decode_backend_ = decode_backend;
+        decode_thread_count_ = decode_thread_count;
+    }
 
     int GetVideoCount()
     {
         return video_count_;
     }
 
+    // Returns synchronized video clip of camera index, so each clip can be read on its own thread.
+    VideoClip* GetVideoClip ( const int index )
+    {
+        return &video_clip_vector_[index];
+    }
+
     // Playbacks all videos with synchronizing shifts together.
     void ViewSynchronizedVideos ();
 
@@ -53,13 +106,30 @@ public:
         return parameters_.camera_name_vector;
     }
 private:
-    // Synchronizes one video clip by comparing its audio samples with referecne samples, and returns the amount of time it leads the reference.
-    double SynchronizeToReference ( const Mat& reference_samples, const Mat& audio_samples, VideoClip* video_clip );
+    // Synchronizes one video clip by correlating its audio samples with the reference prepared by correlator,
+    // and returns the amount of time it leads the reference.
+    double SynchronizeToReference ( const AudioCorrelator& correlator, const Mat& audio_samples, VideoClip* video_clip );
+
+    // Prints drift of video clip over its time map, if any.
+    static void PrintDrift ( VideoClip& video_clip );
+
+    // Returns key of synchronization result of current video files and camera names with current settings.
+    uint64_t ComputeSynchronizationKey ();
 
     SynchParameters parameters_;
     vector<VideoClip> video_clip_vector_;
     int video_count_;
     bool synchronized_;
+    ReadMode read_mode_ = READ_MODE_SEQUENTIAL;
+    DecodeBackend decode_backend_ = DECODE_BACKEND_VIDEO_CAPTURE;
+    int decode_thread_count_ = 0;
+    int audio_sample_rate_ = 8000;
+    bool track_drift_ = false;
+    // Version of synchronization results, changed whenever audio alignment changes.
+    static const uint32_t kSynchronizationVersion = 2;
+    // Buffers of frames read from each video, and of their grayscale conversions.
+    vector<Mat> frame_buffers_;
+    vector<Mat> gray_buffers_;
 };
 
 #endif // COMBINEDVIDEOCLIP_H
@@ -0,0 +1,98 @@
+#ifndef DEMUXER_H
+#define DEMUXER_H
+
+#include <deque>
+#include <iostream>
+#include <string>
+#include <vector>
+
+extern "C"{
+    #include "libavcodec/avcodec.h"
+    #include "libavformat/avformat.h"
+    #include "libavutil/avutil.h"
+}
+
+using namespace std;
+
+// Reads packets of a media file with libavformat, which is opened and probed once and shared by the
+// decoders of its streams. Each decoder reads packets of its own stream in file order. Packets of other
+// wanted streams read on the way are queued for their decoders instead of being read from storage again.
+// A stream whose packets are dropped, as its queue would exceed the byte budget or it is not wanted,
+// resumes after the last packet delivered to its decoder once asked for again: file is sought back to
+// where every wanted stream can resume, and packets already delivered are skipped by decoding timestamp.
+// Streams of one demuxer are read from one thread at a time.
+class Demuxer
+{
+public:
+    Demuxer() {}
+    ~Demuxer();
+
+    bool Open ( const string& file_name );
+
+    void Close();
+
+    bool IsOpened() const
+    {
+        return _format_context != NULL;
+    }
+
+    // Returns index of the best stream of media type and sets its decoder if codec is given, or returns
+    // a negative value if file has no such stream.
+    int FindBestStream ( const AVMediaType media_type, AVCodec** codec = NULL ) const;
+
+    AVFormatContext* GetFormatContext() const
+    {
+        return _format_context;
+    }
+
+    AVStream* GetStream ( const int stream_index ) const
+    {
+        return _format_context->streams[stream_index];
+    }
+
+    // Sets whether packets of stream read while reading other streams are queued for its decoder.
+    // Packets queued are dropped when stream is no longer wanted, and read again if it is read later.
+    void SetStreamWanted ( const int stream_index, const bool wanted );
+
+    // Moves the next packet of stream into packet, to be unreferenced by caller. Returns false at the end of file.
+    bool ReadPacket ( const int stream_index, AVPacket* packet );
+
+    // Seeks stream to the last key frame at or before time in seconds. Packets queued for all streams are
+    // dropped, and other streams resume after their last packets delivered once read. Resuming them may
+    // deliver packets of stream from an earlier key frame, whose frames decoders skip up to time.
+    bool Seek ( const int stream_index, const double seconds );
+
+private:
+    // Non-copyable, as it owns FFmpeg contexts.
+    Demuxer ( const Demuxer& );
+    Demuxer& operator= ( const Demuxer& );
+
+    // Frees packets queued for stream, which then resumes once read.
+    void DropQueue ( const int stream_index );
+
+    // Seeks file back to the earliest resume time of stream and wanted streams, and drops all queues,
+    // so that no stream misses a packet.
+    bool Resume ( const int stream_index );
+
+    // Records packet as delivered to the decoder of its stream.
+    void Deliver ( const AVPacket* packet );
+
+    AVFormatContext* _format_context = NULL;
+    // Whether packets of each stream are queued, and packets queued for each stream.
+    vector<char> _wanted_streams;
+    vector<deque<AVPacket*>> _packet_queues;
+    // Whether each stream has missed packets since they were delivered, so it must resume before it is read.
+    vector<char> _missed_streams;
+    // Time in AV_TIME_BASE units each stream resumes from, of its last packet delivered or last seek,
+    // or AV_NOPTS_VALUE for the start of file.
+    vector<int64_t> _resume_times;
+    // Decoding timestamp of the last packet delivered of each stream, up to which packets read again are
+    // skipped, or AV_NOPTS_VALUE for none.
+    vector<int64_t> _delivered_dts;
+    // Total size of packets queued for all streams.
+    size_t _queued_bytes = 0;
+    // Largest total size of packets queued.
+    static const size_t kMaxQueuedBytes = 256 * 1024 * 1024;
+};
+
+#endif // DEMUXER_H
@@ -0,0 +1,86 @@
+#ifndef DRIFTTRACKER_H
+#define DRIFTTRACKER_H
+
+#include <memory>
+#include <vector>
+
+#include "audio_stream.h"
+#include "time_map.h"
+
+#include "opencv2/opencv.hpp"
+
+using namespace std;
+using namespace cv;
+
+// Follows clock drift of video clips against a reference over whole videos, in one streaming pass over
+// their audio, continuing audio streams after the leading samples already read from them for
+// synchronization. Reference audio is taken in blocks, and each block is correlated with every clip around
+// the lag last found for it, with the block spectrum computed once for all clips. Lags are found in windows
+// of two neighbouring blocks, so each block's correlation is reused by the two windows holding it. Lags of
+// windows whose peak stands out of sidelobes become knots of a time map of each clip.
+class DriftTracker
+{
+public:
+    // Tracks clips against reference audio, whose leading samples were read from reference stream, in blocks
+    // of block seconds, searching lags within search seconds of the last lag found. Audio of clips must have
+    // the sample rate of reference.
+    DriftTracker ( AudioStream* reference_stream, const Mat& reference_samples, const double block_seconds = 5.0,
+                   const double search_seconds = 0.25 );
+
+    // Adds clip whose audio sample t matches reference sample t + initial lag, and whose leading samples
+    // were read from audio stream.
+    void AddClip ( AudioStream* audio_stream, const Mat& leading_samples, const int initial_lag );
+
+    // Reads audio of reference and clips, until either reference or all clips end.
+    void Track();
+
+    // Returns map of shift of clip over time of reference, empty if no window is reliable.
+    const TimeMap& GetTimeMap ( const int index ) const
+    {
+        return _clips[index]->time_map;
+    }
+
+private:
+    // Samples of an audio stream read ahead and not yet passed by blocks, starting at sample index first sample.
+    struct SampleBuffer
+    {
+        AudioStream* audio_stream = NULL;
+        vector<float> samples;
+        int64_t first_sample = 0;
+        bool finished = false;
+    };
+
+    struct ClipState
+    {
+        SampleBuffer buffer;
+        // Lag last accepted, at reference time of last knot.
+        int lag = 0;
+        double lag_time = 0.0;
+        // Correlation of the previous block over lags from its center lag minus search radius.
+        Mat block_correlation;
+        int block_center = 0;
+        TimeMap time_map;
+    };
+
+    // Copies samples in [begin, end) to destination, leaving it unchanged where stream has no sample, and drops
+    // samples before begin. Returns false once stream has ended before begin.
+    bool ReadSamples ( const int64_t begin, const int64_t end, SampleBuffer* buffer, float* destination );
+
+    // Correlates block of reference starting at block start with clip, and adds a knot if the window of this
+    // and the previous block is reliable. Returns false once clip has ended.
+    bool TrackBlock ( const Mat& reference_spectrum, const int64_t block_start, ClipState* clip );
+
+    SampleBuffer _reference;
+    int _sample_rate;
+    int _block_size;
+    int _search_radius;
+    // Length of DFT, covering a block and its search range without wrapping around.
+    int _dft_size;
+    vector<unique_ptr<ClipState>> _clips;
+    // Peak to sidelobe ratio of windows whose lag is accepted.
+    static constexpr double kMinPeakToSidelobe = 8.0;
+    // Largest drift accepted between knots, in seconds per second, well above drift of camera clocks.
+    static constexpr double kMaxDriftRate = 1e-3;
+};
+
+#endif // DRIFTTRACKER_H
@@ -2,38 +2,205 @@
 #define FRAMEMAPPER_H
 
 // External headers
+#include <limits>
 #include <opencv2/opencv.hpp>
 // Owned headers
 #include "camera.h"
 #include "mesh.h"
+#include "output_projection.h"
+#include "blend_kernel.h"
 
 using namespace std;
 using namespace cv;
 
+// Run of consecutive canvas pixels in one row painted the same way from current frame.
+struct RemapSpan
+{
+    // Offset of the first pixel of the run in canvas.
+    int canvas_offset;
+    // Number of pixels in the run.
+    int pixel_count;
+    // Index of the first pixel of the run in its remap table.
+    int first_index;
+};
+
+// Storage of normalized weights, kept as CV_64FC1, or as fixed point in [0, 1] scaled to the full range
+// of CV_16UC1 or CV_8UC1. Fixed-point weights are rounded to nearest, so the maximum quantization error
+// is 0.5 / 65535 (about 7.6e-6) for 16 bits and 0.5 / 255 (about 2.0e-3) for 8 bits.
+enum WeightStorage
+{
+    WEIGHT_STORAGE_DOUBLE,
+    WEIGHT_STORAGE_FIXED_16,
+    WEIGHT_STORAGE_FIXED_8
+};
+
 class FrameMapper
 {
 public:
     FrameMapper() {}
-    FrameMapper(const Camera& camera, const Size& output_size, const int project_size);
+    // Canvas is covered by meshes of project size, each split into a quadtree until bilinear interpolation
+    // of its corners is within mesh tolerance in frame pixels of the exact projection. Non-positive
+    // tolerance keeps meshes of project size. Meshes are clipped to the faces of output projection.
+    FrameMapper(const Camera& camera, const Size& output_size, const int project_size,
+                const WeightStorage weight_storage = WEIGHT_STORAGE_FIXED_16, const double mesh_tolerance = 0.0,
+                const OutputProjection& projection = OutputProjection());
+
+    // Paint mapped pixels to output canvas. Frame and canvas are either both BGR or both single planes.
+    void PaintOnCanvas(const Mat& frame, Mat* canvas) const;
 
-    // Paint mapped pixels to output canvas.
-    void PaintOnCanvas(const Mat& frame, Mat* canvas);
+    // Paint mapped pixels to canvas rows in [row_begin, row_end) only. Painting disjoint row ranges
+    // from several threads at once gives the same canvas as painting them in serial.
+    void PaintOnCanvas(const Mat& frame, Mat* canvas, const int row_begin, const int row_end) const;
 
-    // Normalizes weight mat based on input total weight mat.
+    // Normalizes weight mat based on input total weight mat, and classifies mapped pixels into runs copied
+    // straight from frame, where current camera alone covers canvas, and runs blended in overlaps. Pixels left
+    // to other cameras fall in the gaps between runs and cost nothing to paint. Normalized weights are then
+    // kept in weight storage format.
     void NormalizeWeight(Mat total_weight);
 
-    // Returns current weight mat.
+    // Returns current weight mat covering weight roi of canvas, as CV_64FC1 before normalization
+    // and in weight storage format after.
     Mat GetWeightMat();
 
+    // Returns normalized weight mat covering weight roi of canvas, converted back to CV_64FC1.
+    Mat GetNormalizedWeightMat();
+
+    // Returns mapper of the half resolution chroma planes of YUV 4:2:0 frames to the chroma planes of canvas,
+    // built from the normalized mapping of this mapper.
+    FrameMapper GetChromaMapper() const;
+
+    // Returns the largest interpolation error in frame pixels measured on meshes, which is above
+    // mesh tolerance only where meshes reach minimum size.
+    double GetMaxMeshError() const
+    {
+        return _max_mesh_error;
+    }
+
+    // Returns number of meshes covering the camera's frame.
+    int GetMeshCount() const
+    {
+        return _mesh_count;
+    }
+
+    // Returns size of output canvas.
+    Size GetOutputSize() const
+    {
+        return _output_size;
+    }
+
+    // Returns size of frames painted by current camera.
+    Size GetFrameSize() const
+    {
+        return _frame_size;
+    }
+
+    // Returns remap entries of copied and blended canvas pixels, ordered in canvas.
+    const RemapTable& GetCopySources() const
+    {
+        return _copy_sources;
+    }
+
+    const RemapTable& GetBlendSources() const
+    {
+        return _blend_sources;
+    }
+
+    // Returns fixed-point blending weights of blended canvas pixels, three per pixel.
+    const vector<ushort>& GetBlendWeights() const
+    {
+        return _blend_weights;
+    }
+
+    // Returns numbers of copied and blended runs.
+    int GetCopySpanCount() const
+    {
+        return _copy_spans.size();
+    }
+
+    int GetBlendSpanCount() const
+    {
+        return _blend_spans.size();
+    }
+
+    // Returns the part of canvas covered by weight mat, which bounds the footprint of current camera.
+    Rect GetWeightRoi() const
+    {
+        return _weight_roi;
+    }
+
+    // Returns output projection of canvas.
+    OutputProjection GetProjection() const
+    {
+        return _projection;
+    }
+
+    // Returns mask of meshes covered by the camera, one pixel per mesh. On equirectangular canvas the camera's
+    // frame border is traced back to canvas, then filled on the side holding the camera center and grown by
+    // one mesh. Cubemap faces break the border into pieces, so there mesh corners are projected to frame instead.
+    static Mat ComputeFootprint(const Camera& camera, const Size& output_size, const int project_size,
+                                const OutputProjection& projection = OutputProjection());
+
+    // Returns maximum error of normalized weights kept in given storage format.
+    static double GetMaxQuantizationError(const WeightStorage weight_storage);
+
+    // Writes remap tables and normalized weights to binary stream.
+    void Write(ostream& stream) const;
+
+    // Reads remap tables and normalized weights written by Write from memory for the camera,
+    // and advances data past them. Tables are copied, so data needn't outlive the mapper or be aligned.
+    // Returns false if data is truncated or malformed.
+    bool Read(const Camera& camera, const uchar** data, const uchar* data_end);
+
 private:
+    // Returns mask of meshes with a corner or center landing on frame, grown by one mesh.
+    static Mat SampleFootprint(const Camera& camera, const Size& output_size, const int project_size,
+                               const OutputProjection& projection);
+
+    // Paints frame of given number of 8-bit channels.
+    template<int channels>
+    void PaintPixels(const Mat& frame, Mat* canvas, const int row_begin, const int row_end) const;
+
+    // Splits remap entries into runs of consecutive pixels in one canvas row, indexed by canvas row.
+    void BuildSpans(const RemapTable& sources, vector<RemapSpan>* spans, vector<int>* span_row_begins) const;
+
     // Camera parameters for current frame source.
     Camera _camera;
+    // Size of frames painted, which is halved for chroma planes.
+    Size _frame_size;
     // Size of output frame.
     Size _output_size;
-    // Vector of all meshes mapping from current frame to output canvas.
-    vector<Mesh> _mesh_vector;
-    // Mat of weight of each pixel on current frame to output canvas.
+    // Layout of sphere screen on output frame.
+    OutputProjection _projection;
+    // Runs of canvas pixels copied directly from current frame.
+    vector<RemapSpan> _copy_spans;
+    // Index of the first copy span of each canvas row, with one extra element for the end of the last row.
+    vector<int> _copy_span_row_begins;
+    // Remap entries of copied canvas pixels, computed once for all frames and ordered as in copy spans.
+    RemapTable _copy_sources;
+    // Runs of canvas pixels blended from current frame.
+    vector<RemapSpan> _blend_spans;
+    // Index of the first blend span of each canvas row, with one extra element for the end of the last row.
+    vector<int> _blend_span_row_begins;
+    // Remap entries of blended canvas pixels, ordered as in blend spans.
+    RemapTable _blend_sources;
+    // Fixed-point blending weights of blended canvas pixels, one per channel.
+    vector<ushort> _blend_weights;
+    // Mat of weight of each pixel on current frame to output canvas, covering weight roi only.
     Mat _weight_mat;
+    // Part of canvas covered by weight mat.
+    Rect _weight_roi;
+    // Storage format of normalized weight mat, defaulting as in the constructor.
+    WeightStorage _weight_storage = WEIGHT_STORAGE_FIXED_16;
+    // Scale from normalized weight to stored value, matching the default weight storage.
+    double _weight_scale = numeric_limits<ushort>::max();
+    // Half width of the weight band around 0.5 in which overlapped frames are blended.
+    double _blending_weight_th = 0.1;
+    // Minimum side of meshes split for accuracy.
+    int _min_mesh_size = 2;
+    // Largest interpolation error measured on meshes.
+    double _max_mesh_error = 0.0;
+    // Number of meshes covering the camera's frame.
+    int32_t _mesh_count = 0;
 };
 
 #endif // FRAMEMAPPER_H
@@ -0,0 +1,50 @@
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+using namespace std;
+using namespace cv;
+
+// Fixed set of frame buffers of one size and type, allocated once and leased to pipeline stages, which
+// return them when their pixels are no longer needed. Stages recycling buffers this way allocate no
+// pixel memory per frame, and the pool bounds the frames in flight.
+class FramePool
+{
+public:
+    // Allocates capacity buffers of size and type.
+    FramePool ( const int capacity, const Size& size, const int type );
+
+    // Takes a free buffer, waiting until one is returned if all are leased. Buffers keep pixels of their
+    // last use.
+    Mat Lease();
+
+    // Gives back a buffer leased from this pool, which must not be written afterwards. Empty mats are ignored.
+    void Return ( const Mat& buffer );
+
+    int GetCapacity() const
+    {
+        return _buffers.size();
+    }
+
+    Size GetSize() const
+    {
+        return _size;
+    }
+
+private:
+    Size _size;
+    int _type;
+    // All buffers of the pool.
+    vector<Mat> _buffers;
+    // Buffers not leased, reserved for all buffers so returning never allocates.
+    vector<Mat> _free_buffers;
+    mutex _pool_mutex;
+    condition_variable _returned_condition;
+};
+
+#endif // FRAMEPOOL_H
@@ -4,30 +4,89 @@
 #include <vector>
 #include "utils.h"
 #include "camera.h"
+#include "output_projection.h"
 #include "opencv2/opencv.hpp"
 
 using namespace cv;
 using namespace std;
 
+// Precomputed mapping from canvas pixels to their source pixels on frame, stored as structure of arrays
+// and ordered in canvas.
+struct RemapTable
+{
+    // Offsets of the pixels in canvas, as y * canvas width + x.
+    vector<int> canvas_offsets;
+    // Integer positions of the source pixels on frame.
+    vector<short> frame_xs;
+    vector<short> frame_ys;
+
+    void Append(const int canvas_offset, const short frame_x, const short frame_y)
+    {
+        canvas_offsets.push_back(canvas_offset);
+        frame_xs.push_back(frame_x);
+        frame_ys.push_back(frame_y);
+    }
+
+    void Reserve(const int count)
+    {
+        canvas_offsets.reserve(count);
+        frame_xs.reserve(count);
+        frame_ys.reserve(count);
+    }
+
+    void Clear()
+    {
+        canvas_offsets.clear();
+        frame_xs.clear();
+        frame_ys.clear();
+    }
+
+    int Size() const { return canvas_offsets.size(); }
+};
+
 class Mesh
 {
 public:
     Mesh() {}
-    Mesh(const int row_index, const int col_index, const int mesh_size,
-         const Size& canvas_size, const Camera& camera, Mat* weight_mat);
+    // Creates mesh covering canvas pixels in [x_1, x_2] x [y_1, y_2] of one projection face, and projects its corners to frame.
+    Mesh(const int x_1, const int y_1, const int x_2, const int y_2, const Size& canvas_size,
+         const OutputProjection& projection, const Camera& camera);
 
+    // Returns whether any pixel of mesh lands on frame. Mesh sides map to the straight sides of the quadrilateral
+    // of its corners on frame, so the pixels on mesh sides are tested one by one, and frame is tested for
+    // lying wholly inside the quadrilateral.
     bool CheckValidity(const Camera& camera);
 
-    void Paint(Mat* canvas, const Mat& frame, const Mat& weight_mat);
+    // Returns the largest distance on frame between bilinear interpolation of corners and exact projection,
+    // sampled on a grid of 5 x 5 points across mesh. Returns infinity if only part of the mesh is in front of camera.
+    double MeasureInterpolationError(const Size& canvas_size, const OutputProjection& projection, const Camera& camera) const;
+
+    // Returns whether mesh can be split without getting meshes smaller than minimum size.
+    bool CanSplit(const int min_mesh_size) const;
+
+    // Splits mesh into two or four meshes no smaller than minimum size.
+    vector<Mesh> Split(const int min_mesh_size, const Size& canvas_size, const OutputProjection& projection,
+                       const Camera& camera) const;
+
+    // Calculates local weight of each pixel in mesh as 1/rho. Weight mat covers part of canvas whose
+    // top-left pixel is at weight origin.
+    void ComputeWeights(const Camera& camera, Mat* weight_mat, const Point& weight_origin) const;
+
+    // Appends remap entries of pixels in one canvas row of mesh which land inside the frame.
+    void AppendRemapEntries(const int p_y, const Size& canvas_size, const Size& frame_size, RemapTable* table) const;
+
+    // Returns the left column of mesh on canvas.
+    int GetLeft() const { return _x_1; }
 
 private:
-    bool IsOutOfBound(const Point2d& pt, const int width, const int height);
+    // Interpolates position on frame of canvas pixel in mesh from corners.
+    Point2d Interpolate(const int p_x, const int p_y) const;
+
+    bool IsOutOfBound(const Point2d& pt, const int width, const int height) const;
 
     int _x_1, _x_2;
     int _y_1, _y_2;
     Point2d _pt_a, _pt_b, _pt_c, _pt_d;
-
-    double _blending_weight_th = 0.1;
 };
 
 #endif // MESH_H
@@ -0,0 +1,64 @@
+#ifndef OUTPUTPROJECTION_H
+#define OUTPUTPROJECTION_H
+
+#include <vector>
+
+#include "utils.h"
+
+#include "opencv2/opencv.hpp"
+
+using namespace std;
+using namespace cv;
+
+// Layouts of output canvas on sphere screen.
+enum ProjectionType
+{
+    // Azimuth along columns and elevation along rows.
+    PROJECTION_EQUIRECTANGULAR,
+    // Six cube faces in a 3 x 2 grid, left, front, right on top and bottom, back, top below,
+    // all seen from the inside with up towards the top of canvas. Of the bottom face, front is towards the top of
+    // canvas, and of the top face, back is.
+    PROJECTION_CUBEMAP,
+    // Cubemap layout whose face pixels are spread evenly in angle instead of in distance on face.
+    PROJECTION_EQUIANGULAR_CUBEMAP
+};
+
+class OutputProjection
+{
+public:
+    OutputProjection ( const ProjectionType type = PROJECTION_EQUIRECTANGULAR ) : _type ( type ) {}
+
+    ProjectionType GetType() const
+    {
+        return _type;
+    }
+
+    // Returns canvas size with the angular resolution of an equirectangular canvas of given width at the equator,
+    // rounded down to even width and height so canvas can be stitched and encoded in YUV 4:2:0.
+    Size GetCanvasSize ( const int equirectangular_width ) const;
+
+    // Returns parts of canvas within which neighboring pixels are also neighbors on sphere,
+    // so that meshes never cross their borders.
+    vector<Rect> GetFaceRects ( const Size& canvas_size ) const;
+
+    // Returns the unit 3d point on sphere screen of the 2d point on canvas.
+    Point3d GetSpherePoint ( const Point2d& screen_point, const Size& canvas_size ) const;
+
+    // Returns the 2d point on canvas of the 3d point on sphere screen, inverse of GetSpherePoint.
+    Point2d GetScreenPoint ( const Point3d& sphere_point, const Size& canvas_size ) const;
+
+private:
+    // Directions of cube face center, and of its right and down sides, in world.
+    struct CubeFace
+    {
+        Point3d forward;
+        Point3d right;
+        Point3d down;
+    };
+
+    static const CubeFace kCubeFaces[6];
+
+    ProjectionType _type;
+};
+
+#endif // OUTPUTPROJECTION_H
@@ -2,11 +2,14 @@
 #define PANOVIDEOMAPPER_H
 
 // External headers
+#include <exception>
 #include <string>
 #include <vector>
 #include <unordered_map>
 #include <unordered_set>
 #include <iostream>
+#include <memory>
+#include <thread>
 #include <opencv2/opencv.hpp>
 #include <opencv2/face.hpp>
 #include <boost/filesystem.hpp>
@@ -14,6 +17,13 @@
 #include "utils.h"
 #include "camera.h"
 #include "frame_mapper.h"
+#include "canvas_gatherer.h"
+#include "work_stealing_pool.h"
+#include "spsc_queue.h"
+#include "frame_pool.h"
+#include "video_encoder.h"
+#include "preview_window.h"
+#include "remap_cache.h"
 // Third party headers
 #include "combined_video_clip.h"
 #include "synch_parameters.h"
@@ -22,24 +32,137 @@ using namespace std;
 using namespace cv;
 using namespace boost;
 
+// Output video stitched from the same decoded frames as other renditions.
+struct OutputRendition
+{
+    // Name of output video file without extension.
+    string name;
+    // Scale of angular resolution relative to the full resolution output.
+    double scale;
+};
+
+// Ways frames of all cameras are painted on canvas.
+enum PaintMode
+{
+    // Each camera's frame mapper paints on a cleared canvas in turn, blending on top of earlier cameras.
+    PAINT_MODE_SCATTER,
+    // Each canvas pixel gathers from all of its cameras at once and is written exactly once.
+    PAINT_MODE_GATHER
+};
+
+// Color format frames are stitched in.
+enum StitchColor
+{
+    // Decoded frames are converted to BGR, and canvas is painted in BGR.
+    STITCH_COLOR_BGR,
+    // Y, U and V planes of decoded YUV 4:2:0 frames are painted on the planes of an I420 canvas, the chroma
+    // planes at half resolution, which skips color conversion of input frames and paints half the bytes.
+    STITCH_COLOR_YUV420
+};
+
 class PanoVideoMapper
 {
 public:
     PanoVideoMapper(const string& output_folder, const string& video_list_file);
     ~PanoVideoMapper() {}
 
-    void GeneratePano(const string& calibration_file);
+    // Stitches each synchronized frame set once per rendition, so videos are decoded and synchronized
+    // only once however many renditions are written. Renditions default to one full resolution output,
+    // and their names must be distinct.
+    // Cameras are decoded on threads of their own and videos are written on another thread, overlapping
+    // stitching, and queue counters of the stages are printed after each video. Runs headless unless
+    // a preview rate is set.
+    void GeneratePano(const string& calibration_file,
+                      const vector<OutputRendition>& renditions = vector<OutputRendition>(1, OutputRendition{"pano_video", 1.0}));
     
     void SaveSamples(const float sample_rate);
 
     void EnableFaceDetection();
 
+    // Sets number of threads painting canvas tiles, non-positive for all hardware threads.
+    void SetPaintThreadCount(const int thread_count);
+
+    // Sets library decoding video frames, and total number of decoding threads shared by all cameras,
+    // non-positive for all hardware threads.
+    void SetDecodeBackend(const DecodeBackend decode_backend, const int decode_thread_count);
+
+    // Sets how frames are painted on canvas.
+    void SetPaintMode(const PaintMode paint_mode);
+
+    // Sets color format frames are stitched in. YUV 4:2:0 is always painted by gathering.
+    void SetStitchColor(const StitchColor stitch_color);
+
+    // Sets storage format of normalized weights kept by frame mappers.
+    void SetWeightStorage(const WeightStorage weight_storage);
+
+    // Sets largest error in frame pixels allowed for interpolated meshes, non-positive for fixed size meshes.
+    void SetMeshTolerance(const double mesh_tolerance);
+
+    // Sets folder keeping built frame mappers and synchronization results between runs, empty to always
+    // build mappers and synchronize videos.
+    void SetRemapCacheFolder(const string& remap_cache_folder);
+
+    // Sets whether clock drift of cameras is followed over whole videos, so frames stay synchronized late in long takes.
+    void SetDriftTracking(const bool track_drift);
+
+    // Sets largest rate of preview window showing stitched frames from a thread of its own, non-positive for
+    // headless runs without any window. Pressing 'q' on preview stops stitching the current video.
+    void SetPreviewRate(const double preview_fps);
+
+    // Sets encoder, rate control and threading of output videos.
+    void SetEncoderSettings(const EncoderSettings& encoder_settings);
+
+    // Sets layout of output frames, sized to keep the angular resolution of equirectangular output in all renditions.
+    void SetOutputProjection(const ProjectionType projection_type);
+
 private:
     // Reads video list file content to class parameteres.
     void ReadInVideoListFile(const string& video_list_file);
     
     // Reads camera calibration parameters from calibration file.
     void ReadCameraCalibration(const string& calibration_file);
+
+    // Builds and normalizes frame mappers of all cameras for output size, or loads them from remap cache.
+    void PrepareFrameMappers(const Size& output_size, unordered_map<string, FrameMapper>* frame_mapper_map);
+
+    // Paints frames of all cameras on canvas with their frame mappers, tile by tile in parallel.
+    void PaintFrames(const vector<Mat>& frame_vector, const vector<string>& camera_names,
+                     const unordered_map<string, FrameMapper>& frame_mapper_map, WorkStealingPool* paint_pool, Mat* canvas);
+
+    // Gathers every canvas pixel from frames of all cameras at once, tile by tile in parallel.
+    // Uncovered canvas pixels get fill value.
+    void GatherFrames(const vector<Mat>& frame_vector, const CanvasGatherer& canvas_gatherer, WorkStealingPool* paint_pool, Mat* canvas,
+                      const uchar fill_value = 0);
+
+    // Decodes frames of video clip at every output frame time into buffers leased from pool, as BGR frames
+    // or as I420 buffers of Y, U and V planes, and queues them until the clip has finished or queue is closed,
+    // then closes queue. Empty frames are queued while clip has no frame. An exception stops decoding and is
+    // stored in error before queue is closed, to be rethrown by the stitching thread.
+    void DecodeFrames(VideoClip* video_clip, const bool read_planes, FramePool* frame_pool, SpscQueue<Mat>* decode_queue,
+                      exception_ptr* error);
+
+    // Encodes output frames of each rendition from queue, as BGR frames or I420 buffers, until queue is closed
+    // and drained, returning them to the pools of their renditions. An exception stops encoding, is stored in
+    // error and closes queue, so the stitching thread stops pushing and rethrows it.
+    void EncodeFrames(SpscQueue<vector<Mat>>* encode_queue, vector<unique_ptr<VideoEncoder>>* video_encoders,
+                      vector<unique_ptr<FramePool>>* output_pools, exception_ptr* error);
+
+    // Draws rectangle of BGR color on Y, U and V planes of YUV 4:2:0 frame.
+    static void DrawRectangleOnPlanes(Mat planes[3], const Rect& rect, const Scalar& color, const int thickness);
+
+    // Returns size of single row buffer holding Y plane of luma size followed by U and V planes of half resolution.
+    static Size GetPlanesBufferSize(const Size& luma_size);
+
+    // Views Y, U and V planes of buffer of planes buffer size.
+    static void SplitPlanes(const Mat& buffer, const Size& luma_size, Mat planes[3]);
+
+    // Prints counters of queue feeding a pipeline stage.
+    static void PrintQueueStats(const string& stage_name, const QueueStats& stats, const int capacity);
+
+    // Gathers Y planes of planes buffers of all cameras on the Y plane of canvas buffer, and their U and V planes
+    // on the chroma planes. Empty buffers contribute nothing.
+    void StitchPlanes(const vector<Mat>& frame_buffers, const CanvasGatherer& luma_gatherer,
+                      const CanvasGatherer& chroma_gatherer, WorkStealingPool* paint_pool, Mat* yuv_canvas);
     
     //================= Basic parameters
     
@@ -58,14 +181,46 @@ private:
     
     // Frame rate of output video.
     const int fps_;
-    // Frame size of output video or frames.
-    const Size output_size_;
+    // Width of full resolution equirectangular output frames, which sets angular resolution of all projections.
+    const int equirectangular_width_;
+    // Layout of output video or frames.
+    OutputProjection output_projection_;
     // Map from name to all cameras, holding intrinsic and extrinsic.
     unordered_map<string, Camera> cameras_map_;
-    // Unordered map of frame mappers.
-    unordered_map<string, FrameMapper> frame_mapper_map_;
+    // Storage format of normalized weights in frame mappers.
+    WeightStorage weight_storage_;
+    // Largest size of meshes projected from canvas to frames.
+    const int project_size_;
+    // Size of meshes projected from canvas to frames when they are not split for accuracy.
+    const int fixed_project_size_;
+    // Largest error in frame pixels allowed for interpolated meshes.
+    double mesh_tolerance_;
+    // Folder keeping built frame mappers and synchronization results between runs.
+    string remap_cache_folder_;
     // Face classifier.
     CascadeClassifier haar_cascade_;
+    // Encoder, rate control and threading of output videos.
+    EncoderSettings encoder_settings_;
+    // Library decoding video frames.
+    DecodeBackend decode_backend_;
+    // Total number of decoding threads shared by all cameras.
+    int decode_thread_count_;
+    // Way frames are painted on canvas.
+    PaintMode paint_mode_;
+    // Color format frames are stitched in.
+    StitchColor stitch_color_;
+    // Number of threads painting canvas tiles.
+    int paint_thread_count_;
+    // Number of canvas rows in each painting tile.
+    const int paint_tile_height_;
+    // Number of frames each queue between decoding, stitching and encoding stages holds.
+    const int pipeline_queue_capacity_;
+    // Largest rate of preview window, non-positive for headless runs.
+    double preview_fps_;
+    // Largest width of frames shown on preview window.
+    const int preview_width_;
+    // Whether clock drift of cameras is tracked during synchronization.
+    bool track_drift_;
     
     //================= Sample frame from video
     
@@ -0,0 +1,70 @@
+#ifndef PREVIEWWINDOW_H
+#define PREVIEWWINDOW_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "opencv2/opencv.hpp"
+
+using namespace std;
+using namespace cv;
+
+// Window showing frames of a running job on a thread of its own, so all HighGUI calls stay off the
+// processing loop. Offered frames are taken at a capped rate and scaled down, and frames offered while
+// the preview is busy or not due are skipped, so offering never waits for the window.
+class PreviewWindow
+{
+public:
+    // Opens window showing at most max fps frames no wider than max width.
+    PreviewWindow ( const string& window_name, const double max_fps, const int max_width );
+    // Closes window and stops its thread.
+    ~PreviewWindow();
+
+    // Offers BGR frame shown at time in seconds, which is scaled down and copied only if preview is due.
+    // Returns whether frame is taken.
+    bool Offer ( const Mat& frame, const double time );
+
+    // Offers Y, U and V planes of YUV 4:2:0 frame, converted to BGR on preview thread.
+    bool OfferPlanes ( const Mat planes[3], const double time );
+
+    // Returns whether 'q' was pressed on window.
+    bool IsQuitRequested() const
+    {
+        return _quit_requested;
+    }
+
+private:
+    // Non-copyable, as it owns a thread.
+    PreviewWindow ( const PreviewWindow& );
+    PreviewWindow& operator= ( const PreviewWindow& );
+
+    // Returns size of frame scaled down to max width, rounded to even sides for YUV 4:2:0.
+    Size GetPreviewSize ( const Size& frame_size ) const;
+
+    // Shows taken frames and handles window events until stopped.
+    void ShowLoop();
+
+    string _window_name;
+    // Shortest time in seconds between taken frames.
+    double _min_interval;
+    int _max_width;
+    // Scaled frame waiting to be shown, as BGR or as I420 image, and its time.
+    Mat _pending_frame;
+    bool _pending_yuv = false;
+    bool _has_pending = false;
+    double _pending_time = 0.0;
+    // When the last frame was taken.
+    chrono::steady_clock::time_point _last_taken;
+    bool _has_taken = false;
+    bool _stopping = false;
+    atomic<bool> _quit_requested;
+    mutex _frame_mutex;
+    condition_variable _frame_condition;
+    thread _thread;
+};
+
+#endif // PREVIEWWINDOW_H
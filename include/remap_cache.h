@@ -0,0 +1,45 @@
+#ifndef REMAPCACHE_H
+#define REMAPCACHE_H
+
+#include <string>
+#include <unordered_map>
+
+#include "camera.h"
+#include "frame_mapper.h"
+
+#include "opencv2/opencv.hpp"
+
+using namespace std;
+using namespace cv;
+
+// Binary cache of built and normalized frame mappers, shared between runs with the same calibration
+// and output geometry. The file starts with a magic number, format version and key, followed by
+// mappers of all cameras.
+class RemapCache
+{
+public:
+    // Returns key of frame mappers built from the cameras with given output geometry.
+    static uint64_t ComputeKey ( const unordered_map<string, Camera>& cameras_map, const Size& output_size,
+                                 const int project_size, const double mesh_tolerance, const WeightStorage weight_storage,
+                                 const ProjectionType projection_type );
+
+    // Returns cache file name of the key in folder.
+    static string GetFileName ( const string& folder, const uint64_t key );
+
+    // Loads frame mappers of all cameras with output size from cache file. Returns false if file doesn't exist,
+    // or has other version or key, or is malformed: truncated, holding a camera twice, or with any table
+    // reaching out of canvas or frame. File is mapped read-only and its tables are copied into the mappers,
+    // which own them past the load and outlive the file, whose entries are not aligned for use in place.
+    static bool Load ( const string& file_name, const uint64_t key, const unordered_map<string, Camera>& cameras_map,
+                       const Size& output_size, unordered_map<string, FrameMapper>* frame_mapper_map );
+
+    // Saves frame mappers of all cameras to cache file. The file is written to a temporary file first
+    // and renamed, so concurrent runs never see a partial cache.
+    static bool Save ( const string& file_name, const uint64_t key, const unordered_map<string, FrameMapper>& frame_mapper_map );
+
+private:
+    static const uint32_t kMagic = 0x43525650; // "PVRC"
+    static const uint32_t kVersion = 6;
+};
+
+#endif // REMAPCACHE_H
@@ -0,0 +1,156 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Counters of a queue between two pipeline stages, read once both stages have stopped or as a snapshot.
+struct QueueStats
+{
+    // Number of items pushed.
+    long push_count;
+    // Number of pushes that found the queue full and waited for the consumer, which is backpressure
+    // on the producing stage.
+    long full_waits;
+    // Number of pops that found the queue empty and waited for the producer, which starves the consuming stage.
+    long empty_waits;
+    // Sum of queue depth right after each push, for the mean depth.
+    long depth_sum;
+    // Largest queue depth seen.
+    int max_depth;
+
+    double GetMeanDepth() const
+    {
+        return push_count > 0 ? ( double ) depth_sum / push_count : 0.0;
+    }
+};
+
+// Bounded lock-free ring passing items from one producer thread to one consumer thread. The producer
+// blocks while the ring is full, so a slow consumer holds back its producer instead of letting items
+// pile up. Waiting threads spin briefly, then sleep in short steps, as items come at frame rate.
+template<typename T>
+class SpscQueue
+{
+public:
+    explicit SpscQueue ( const int capacity )
+        : _capacity ( capacity > 0 ? capacity : 1 ), _slots ( _capacity ), _head ( 0 ), _tail ( 0 ), _closed ( false ),
+          _push_count ( 0 ), _full_waits ( 0 ), _empty_waits ( 0 ), _depth_sum ( 0 ), _max_depth ( 0 ) {}
+
+    // Moves item into the ring, waiting while it is full. Returns false without pushing if queue is closed.
+    bool Push ( T item )
+    {
+        size_t tail = _tail.load ( memory_order_relaxed );
+        if ( tail - _head.load ( memory_order_acquire ) == _capacity )
+        {
+            _full_waits.fetch_add ( 1, memory_order_relaxed );
+            for ( int spin=0; tail - _head.load ( memory_order_acquire ) == _capacity; spin++ )
+            {
+                if ( _closed.load ( memory_order_acquire ) )
+                {
+                    return false;
+                }
+                Wait ( spin );
+            }
+        }
+        if ( _closed.load ( memory_order_acquire ) )
+        {
+            return false;
+        }
+        _slots[tail % _capacity] = move ( item );
+        _tail.store ( tail + 1, memory_order_release );
+        int depth = tail + 1 - _head.load ( memory_order_acquire );
+        _push_count.fetch_add ( 1, memory_order_relaxed );
+        _depth_sum.fetch_add ( depth, memory_order_relaxed );
+        if ( depth > _max_depth.load ( memory_order_relaxed ) )
+        {
+            _max_depth.store ( depth, memory_order_relaxed );
+        }
+        return true;
+    }
+
+    // Moves the oldest item out of the ring, waiting while it is empty. Returns false once queue is
+    // closed and all items pushed before are popped.
+    bool Pop ( T* item )
+    {
+        size_t head = _head.load ( memory_order_relaxed );
+        if ( _tail.load ( memory_order_acquire ) == head )
+        {
+            _empty_waits.fetch_add ( 1, memory_order_relaxed );
+            for ( int spin=0; _tail.load ( memory_order_acquire ) == head; spin++ )
+            {
+                // Items pushed before closing are still delivered.
+                if ( _closed.load ( memory_order_acquire ) && _tail.load ( memory_order_acquire ) == head )
+                {
+                    return false;
+                }
+                Wait ( spin );
+            }
+        }
+        T& slot = _slots[head % _capacity];
+        *item = move ( slot );
+        slot = T();
+        _head.store ( head + 1, memory_order_release );
+        return true;
+    }
+
+    // Closes queue from either side: pushes fail from now on, and pops fail once the ring is drained.
+    void Close()
+    {
+        _closed.store ( true, memory_order_release );
+    }
+
+    // Returns number of items in the ring.
+    int GetDepth() const
+    {
+        return _tail.load ( memory_order_acquire ) - _head.load ( memory_order_acquire );
+    }
+
+    int GetCapacity() const
+    {
+        return _capacity;
+    }
+
+    QueueStats GetStats() const
+    {
+        QueueStats stats;
+        stats.push_count = _push_count.load ( memory_order_relaxed );
+        stats.full_waits = _full_waits.load ( memory_order_relaxed );
+        stats.empty_waits = _empty_waits.load ( memory_order_relaxed );
+        stats.depth_sum = _depth_sum.load ( memory_order_relaxed );
+        stats.max_depth = _max_depth.load ( memory_order_relaxed );
+        return stats;
+    }
+
+private:
+    // Yields for the first rounds of waiting, then sleeps.
+    static void Wait ( const int spin )
+    {
+        if ( spin < 64 )
+        {
+            this_thread::yield();
+        }
+        else
+        {
+            this_thread::sleep_for ( chrono::microseconds ( 200 ) );
+        }
+    }
+
+    const size_t _capacity;
+    vector<T> _slots;
+    // Number of items popped, written by the consumer only.
+    atomic<size_t> _head;
+    // Number of items pushed, written by the producer only.
+    atomic<size_t> _tail;
+    atomic<bool> _closed;
+    atomic<long> _push_count;
+    atomic<long> _full_waits;
+    atomic<long> _empty_waits;
+    atomic<long> _depth_sum;
+    atomic<int> _max_depth;
+};
+
+#endif // SPSCQUEUE_H
@@ -3,6 +3,8 @@
 
 #include <vector>
 #include <string>
+
+#include "time_map.h"
   
 using namespace std;
 using namespace boost;
@@ -12,6 +14,8 @@ struct SynchParameters
   vector<string> video_file_vector;
   vector<string> camera_name_vector;
   vector<double> time_offset;
+  // Maps of shift over time following clock drift, empty for constant offsets.
+  vector<TimeMap> time_maps;
   double shift_window;
 };
 
@@ -0,0 +1,42 @@
+#ifndef TIMEMAP_H
+#define TIMEMAP_H
+
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+using namespace std;
+using namespace cv;
+
+// Piecewise-linear map from global time to the shift in seconds of a video clip, whose local time is global
+// time minus shift. Shift is interpolated linearly between knots, and stays at the nearest knot outside them.
+class TimeMap
+{
+public:
+    TimeMap() {}
+
+    // Appends knot of shift at global time, later than all knots added before.
+    void AddKnot ( const double global_time, const double shift );
+
+    // Returns shift at global time, or 0 if map has no knot.
+    double GetShift ( const double global_time ) const;
+
+    // Adds offset to global time and shift of all knots, as when global time starts offset seconds earlier.
+    void AddOffset ( const double offset );
+
+    bool IsEmpty() const
+    {
+        return _knots.empty();
+    }
+
+    // Returns knots ordered in time, with global time as x and shift as y.
+    const vector<Point2d>& GetKnots() const
+    {
+        return _knots;
+    }
+
+private:
+    vector<Point2d> _knots;
+};
+
+#endif // TIMEMAP_H
@@ -41,8 +41,21 @@ public:
     // Returns the 3d point on sphere screen based on the normalized 2d point [0, 1) in mesh.
     static Point3d GetSpherePointFromScreenPoint( const Point2d& screen_point, const Size& canvas_size, const double radius);
 
+    // Returns the 2d point on screen of the 3d point on sphere screen, inverse of GetSpherePointFromScreenPoint.
+    static Point2d GetScreenPointFromSpherePoint( const Point3d& sphere_point, const Size& canvas_size );
+
     // Evaluates polynomial equation.
     static double EvaluatePolyEquation ( const double* coefficients, const int n, const double x );
+
+    // Returns 64-bit FNV-1a hash of bytes, continuing from a previous hash if given.
+    static uint64_t HashBytes ( const void* data, const size_t size, const uint64_t hash = 14695981039346656037ULL );
+
+    // Returns hash of file identity: its path, size, modification time and leading bytes, continuing from a previous
+    // hash if given. It changes when file is replaced or rewritten, without reading whole videos.
+    static uint64_t HashFileIdentity ( const string& path, const uint64_t hash = 14695981039346656037ULL );
+
+    // Evaluates derivative of polynomial equation.
+    static double EvaluatePolyDerivative ( const double* coefficients, const int n, const double x );
 };
 
 #endif // UTILS_H
@@ -1,8 +1,14 @@
 #ifndef VIDEOCLIP_H
 #define VIDEOCLIP_H
 
+#include <memory>
 #include <string>
 
+#include "audio_stream.h"
+#include "demuxer.h"
+#include "time_map.h"
+#include "video_decoder.h"
+
 #include "opencv2/opencv.hpp"
 
 extern "C"{
@@ -13,6 +19,24 @@ extern "C"{
 
 using namespace std;
 using namespace cv;
+
+// Ways frames are read at increasing times.
+enum ReadMode
+{
+    // Seeks to the time of every frame read.
+    READ_MODE_SEEK,
+    // Keeps decoding forward and returns the frame of the nearest timestamp, seeking only on discontinuities.
+    READ_MODE_SEQUENTIAL
+};
+
+// Libraries decoding video frames.
+enum DecodeBackend
+{
+    // OpenCV VideoCapture, giving BGR frames.
+    DECODE_BACKEND_VIDEO_CAPTURE,
+    // libavcodec directly, with configurable threading and access to decoded planes.
+    DECODE_BACKEND_FFMPEG
+};
   
 class VideoClip
 {
@@ -21,14 +45,67 @@ public:
     VideoClip ( const string& file_name, const string& camera_name )
         : _file_name ( file_name ), _camera_name ( camera_name ) {}
         
-    bool ExtractAudioSamples ( Mat* mat, const int duration );
+    // Extracts audio of the first duration seconds, mixed down to mono float samples at sample rate, 0 for the
+    // native rate of the stream. Samples are stored as one row of CV_32FC1. Audio stays open after them, so
+    // the rest can be read from audio stream until audio is closed. With FFmpeg backend, video packets read
+    // meanwhile are kept for decoding, so the leading part of file is read from storage only once.
+    // Returns false if audio cannot be opened or no sample is decoded, leaving the error to the caller, as
+    // samples of several videos are extracted on worker threads.
+    bool ExtractAudioSamples ( Mat* mat, const int duration, const int sample_rate = 0 );
+
+    // Returns audio stream opened by ExtractAudioSamples, or NULL.
+    AudioStream* GetAudioStream() {
+        return _audio_stream.get();
+    }
+
+    // Returns native sample rate of the best audio stream, or 0 if file has no audio.
+    int ProbeAudioSampleRate();
+
+    // Stops keeping video packets read with audio, before audio is read past the leading part of file.
+    // Video is read again from storage once decoded.
+    void StopKeepingVideoPackets();
+
+    // Closes audio stream and drops its packets, once synchronization no longer needs audio.
+    void CloseAudio();
+    // Returns frame shown at global time, or empty frame if video has not started or has finished.
     Mat ReadSynchedFrame(const double global_time);
+
+    // Reads frame shown at global time into given buffer, reused if it has frame size and type.
+    // A frame shown again is copied from the buffer it was read into, so clips read this way should not
+    // be read by the returning overload as well. Returns false if video has not started or has finished.
+    bool ReadSynchedFrame ( const double global_time, Mat* frame );
+
+    // Reads Y, U and V planes of the frame shown at global time as limited range YUV 4:2:0, with chroma planes
+    // of half resolution. Decoded limited range planes of FFmpeg backend are returned without copy or conversion,
+    // and stay valid until the next read. Returns false if video has not started or has finished.
+    bool ReadSynchedPlanes ( const double global_time, vector<Mat>* planes );
+
+    // Returns whether video has no more frame at or after global time, as found by the last read,
+    // unlike not having started yet. Videos that can't be opened have finished.
+    bool HasFinished ( const double global_time );
     
     // Setters
     
     void SetShiftInSeconds ( double shift ) {
         _shift_in_seconds = shift;
     }
+
+    // Sets map of shift over global time, which follows clock drift of camera and replaces the constant
+    // shift in seconds unless empty.
+    void SetTimeMap ( const TimeMap& time_map ) {
+        _time_map = time_map;
+    }
+
+    void SetReadMode ( const ReadMode read_mode ) {
+        _read_mode = read_mode;
+    }
+
+    // Sets library decoding frames, and number of decoding threads for FFmpeg, 0 for automatic.
+    // Takes effect when video is opened by the first read.
+    void SetDecodeBackend ( const DecodeBackend decode_backend, const int decode_thread_count ) {
+        _decode_backend = decode_backend;
+        _decode_thread_count = decode_thread_count;
+    }
     
     // Getters
     
@@ -43,6 +120,10 @@ public:
     double GetShiftInSeconds() {
         return _shift_in_seconds;
     }
+
+    const TimeMap& GetTimeMap() {
+        return _time_map;
+    }
     
     double GetAudioSampleRate() {
         return _audio_sample_rate;
@@ -51,16 +132,63 @@ public:
     Size GetFrameSize() {
         return _frame_size;
     }
+
+    // Returns decoded planes of the frame last read with FFmpeg backend, or NULL with other backends.
+    // The frame is valid until the next read.
+    const AVFrame* GetDecodedFrame() {
+        return _decode_backend == DECODE_BACKEND_FFMPEG && _video_decoder && _has_grabbed ? _video_decoder->GetFrame() : NULL;
+    }
     
 private:
-    void CopySamplesToVector ( const AVCodecContext* codec_context, const AVFrame* frame, vector<float>& samples );
+    // Returns local time of video shown at global time.
+    double GetLocalTime ( const double global_time ) const {
+        return global_time - ( _time_map.IsEmpty() ? _shift_in_seconds : _time_map.GetShift ( global_time ) );
+    }
+
+    // Decodes forward to the frame whose timestamp is nearest to local time without converting it.
+    // Seeks first if forced, or if local time isn't reachable by decoding forward. Returns false if video has finished.
+    bool GrabNearestFrame ( const double local_time, const bool force_seek );
+
+    // Converts the nearest frame to BGR once, and returns it.
+    Mat RetrieveNearestFrame();
+
+    // Returns demuxer of file shared by audio and video decoding, opening it on first use.
+    shared_ptr<Demuxer> GetDemuxer();
+
+    // Opens video with decode backend.
+    void OpenVideo();
+    bool IsVideoOpened();
+    // Decodes next frame and updates grabbed time, seeks to time in seconds, and converts grabbed frame
+    // to BGR with decode backend.
+    bool GrabFrame();
+    void SeekFrame ( const double seconds );
+    bool RetrieveFrame ( Mat* frame );
 
     string _file_name;
     string _camera_name;
     double _shift_in_seconds;
+    TimeMap _time_map;
     double _audio_sample_rate;
     Size _frame_size;
     VideoCapture _video_capture;
+    // Shared by copies of clip, as video capture is.
+    shared_ptr<Demuxer> _demuxer;
+    shared_ptr<AudioStream> _audio_stream;
+    shared_ptr<VideoDecoder> _video_decoder;
+    DecodeBackend _decode_backend = DECODE_BACKEND_VIDEO_CAPTURE;
+    int _decode_thread_count = 0;
+    ReadMode _read_mode = READ_MODE_SEQUENTIAL;
+    // Nominal time between frames in seconds.
+    double _frame_interval = 1.0 / 30;
+    // Largest forward jump in seconds decoded through instead of seeking.
+    double _max_forward_gap = 2.0;
+    // Whether a frame has been grabbed since opening or seeking, and its timestamp in seconds.
+    bool _has_grabbed = false;
+    double _grabbed_time = 0.0;
+    // Whether the grabbed frame has been converted to current frame.
+    bool _frame_retrieved = false;
+    bool _end_of_stream = false;
+    Mat _frame;
 };
 
 #endif // VIDEOCLIP_H
@@ -0,0 +1,85 @@
+#ifndef VIDEODECODER_H
+#define VIDEODECODER_H
+
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "demuxer.h"
+
+#include "opencv2/opencv.hpp"
+
+extern "C"{
+    #include "libavcodec/avcodec.h"
+    #include "libavformat/avformat.h"
+    #include "libavutil/avutil.h"
+    #include "libswscale/swscale.h"
+}
+
+using namespace std;
+using namespace cv;
+
+// Decodes the video stream of a file directly with libavcodec, reading packets from a demuxer which may be
+// shared with decoders of other streams. Decoded frames are kept as AVFrame, whose planes are available
+// without copy, and are only converted to BGR on request.
+class VideoDecoder
+{
+public:
+    VideoDecoder() {}
+    ~VideoDecoder();
+
+    // Opens the best video stream of the demuxer. Decoder runs on thread count threads, 0 for automatic,
+    // with FF_THREAD_FRAME and FF_THREAD_SLICE threading as allowed by thread type.
+    bool Open ( const shared_ptr<Demuxer>& demuxer, const int thread_count, const int thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE );
+
+    void Close();
+
+    bool IsOpened() const
+    {
+        return _codec_context != NULL;
+    }
+
+    // Decodes the next frame. Returns false at the end of stream.
+    bool Grab();
+
+    // Converts the grabbed frame to BGR.
+    bool Retrieve ( Mat* frame );
+
+    // Seeks to the last key frame at or before time in seconds, so the following grabs decode forward from there.
+    bool Seek ( const double seconds );
+
+    // Returns the grabbed frame, valid until the next grab or seek.
+    const AVFrame* GetFrame() const
+    {
+        return _frame;
+    }
+
+    // Returns presentation time of the grabbed frame in seconds from the start of stream.
+    double GetTimestamp() const
+    {
+        return _timestamp;
+    }
+
+    double GetFrameRate() const;
+
+    Size GetFrameSize() const;
+
+private:
+    // Non-copyable, as it owns FFmpeg contexts.
+    VideoDecoder ( const VideoDecoder& );
+    VideoDecoder& operator= ( const VideoDecoder& );
+
+    shared_ptr<Demuxer> _demuxer;
+    AVCodecContext* _codec_context = NULL;
+    AVFrame* _frame = NULL;
+    // Frame being decoded, which replaces grabbed frame only once complete.
+    AVFrame* _decoding_frame = NULL;
+    AVPacket* _packet = NULL;
+    SwsContext* _sws_context = NULL;
+    int _stream_index = -1;
+    // Whether end of file was reached and decoder is being drained.
+    bool _draining = false;
+    double _timestamp = 0.0;
+};
+
+#endif // VIDEODECODER_H
@@ -0,0 +1,92 @@
+#ifndef VIDEOENCODER_H
+#define VIDEOENCODER_H
+
+#include <iostream>
+#include <string>
+
+#include "opencv2/opencv.hpp"
+
+extern "C"{
+    #include "libavcodec/avcodec.h"
+    #include "libavformat/avformat.h"
+    #include "libavutil/avutil.h"
+    #include "libavutil/opt.h"
+    #include "libswscale/swscale.h"
+}
+
+using namespace std;
+using namespace cv;
+
+// Encoder and rate control of output videos.
+struct EncoderSettings
+{
+    // Name of libavcodec encoder, such as libx264 or libx265. Encoders not built into FFmpeg fall back to mpeg4.
+    string codec_name = "libx264";
+    // Speed and compression tradeoff of encoders with presets, such as x264 and x265, empty for encoder default.
+    string preset = "medium";
+    // Constant rate factor of quality based rate control, used when bit rate isn't set. Encoders without
+    // CRF use a constant quantizer instead.
+    int crf = 23;
+    // Average bit rate in bits per second, non-positive for quality based rate control.
+    int64_t bit_rate = 0;
+    // Largest number of frames between key frames.
+    int gop_size = 60;
+    // Number of encoding threads, 0 for automatic.
+    int thread_count = 0;
+};
+
+// Encodes video frames directly with libavcodec and muxes them with libavformat into a file whose
+// container is chosen by its extension. Frames are encoded as limited range YUV 4:2:0, and tagged so.
+class VideoEncoder
+{
+public:
+    VideoEncoder() {}
+    ~VideoEncoder();
+
+    // Creates the file and opens encoder for frames of frame size at given frame rate.
+    bool Open ( const string& file_name, const Size& frame_size, const double fps, const EncoderSettings& settings );
+
+    // Flushes frames buffered by encoder, finishes the file and closes it.
+    void Close();
+
+    bool IsOpened() const
+    {
+        return _codec_context != NULL;
+    }
+
+    // Encodes BGR frame, converted to YUV 4:2:0 with swscale.
+    bool Write ( const Mat& frame );
+
+    // Encodes Y, U and V planes of limited range YUV 4:2:0 frame without color conversion.
+    bool WritePlanes ( const Mat planes[3] );
+
+    // Returns name of encoder actually used.
+    string GetCodecName() const;
+
+    Size GetFrameSize() const
+    {
+        return IsOpened() ? Size ( _codec_context->width, _codec_context->height ) : Size();
+    }
+
+private:
+    // Non-copyable, as it owns FFmpeg contexts.
+    VideoEncoder ( const VideoEncoder& );
+    VideoEncoder& operator= ( const VideoEncoder& );
+
+    // Sends frame to encoder, or flushes it with NULL frame, and writes all packets it gives back.
+    bool Encode ( AVFrame* frame );
+
+    // Quantizer scale of quality based rate control for encoders without CRF.
+    static const int kFallbackQuantizer = 4;
+
+    AVFormatContext* _format_context = NULL;
+    AVCodecContext* _codec_context = NULL;
+    AVStream* _stream = NULL;
+    AVFrame* _frame = NULL;
+    AVPacket* _packet = NULL;
+    SwsContext* _sws_context = NULL;
+    // Presentation time of the next frame in codec time base.
+    int64_t _next_pts = 0;
+};
+
+#endif // VIDEOENCODER_H
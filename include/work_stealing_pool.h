@@ -0,0 +1,71 @@
+#ifndef WORKSTEALINGPOOL_H
+#define WORKSTEALINGPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+class WorkStealingPool
+{
+public:
+    // Creates a pool running tasks on thread_count threads, including the calling thread.
+    // Non-positive thread count uses all hardware threads.
+    explicit WorkStealingPool ( const int thread_count = 0 );
+    ~WorkStealingPool();
+
+    // Runs task(i) for every i in [0, task_count) and blocks until all of them are finished.
+    // Tasks are dealt to threads in contiguous blocks, and idle threads steal from the others. If tasks
+    // throw, the other tasks still run, and the first exception is rethrown on the calling thread.
+    void ParallelFor ( const int task_count, const function<void ( int ) >& task );
+
+    int GetThreadCount() const
+    {
+        return _thread_count;
+    }
+
+private:
+    struct TaskQueue
+    {
+        mutex queue_mutex;
+        deque<int> tasks;
+    };
+
+    // Waits for new tasks and runs them until the pool is destroyed.
+    void WorkerLoop ( const int worker_index );
+
+    // Runs tasks from own queue first, then steals from other queues until all queues are empty.
+    void RunTasks ( const int worker_index, const function<void ( int ) >& task );
+
+    // Takes next task from the back of own queue.
+    bool PopTask ( const int worker_index, int* task_index );
+
+    // Takes a task from the front of any other queue.
+    bool StealTask ( const int worker_index, int* task_index );
+
+    int _thread_count;
+    vector<thread> _threads;
+    vector<unique_ptr<TaskQueue>> _queues;
+    // Task of current round, valid while round is running.
+    const function<void ( int ) >* _task = nullptr;
+    // Number of unfinished tasks of current round.
+    atomic<int> _remaining_tasks;
+    // First exception thrown by a task of current round, guarded by state mutex.
+    exception_ptr _task_exception;
+    // Number of worker threads still inside current round.
+    int _running_workers = 0;
+    long _round = 0;
+    bool _stopping = false;
+    mutex _state_mutex;
+    condition_variable _start_condition;
+    condition_variable _done_condition;
+};
+
+#endif // WORKSTEALINGPOOL_H
@@ -1,5 +1,6 @@
 // External header
 #include <string>
+#include <sstream>
 #include <chrono>
 #include <opencv2/opencv.hpp>
 // Owned header
@@ -18,7 +19,24 @@ const char* keys =
     "{c calib||Input file storing calibration results}"
     "{p pano||Stitch and output panoramic video}"
     "{s sample|0|Sampling rate in fps, 0 for not sampling}"
-    "{f face||Enable face detection}";
+    "{f face||Enable face detection}"
+    "{t threads|0|Number of threads painting panoramic frames, 0 for all hardware threads}"
+    "{m cache||Folder keeping remap and synchronization caches between runs}"
+    "{e error|0.5|Largest interpolation error of meshes in pixels, 0 for fixed size meshes}"
+    "{o projection|equirect|Layout of panoramic frames, one of equirect, cubemap and eac}"
+    "{d decoder|capture|Video decoder, capture for OpenCV VideoCapture or ffmpeg for libavcodec}"
+    "{j decode_threads|0|Total number of ffmpeg decoding threads shared by all cameras, 0 for all hardware threads}"
+    "{g scatter||Paint frames camera by camera instead of gathering each canvas pixel once}"
+    "{y yuv||Stitch Y, U and V planes of YUV 4:2:0 frames instead of BGR frames, best with ffmpeg decoder}"
+    "{drift||Track clock drift of cameras over whole videos}"
+    "{v preview|0|Largest rate in fps of preview window shown from its own thread, 0 for headless batch runs}"
+    "{codec|libx264|Encoder of panoramic videos, e.g. libx264 or libx265, falling back to mpeg4 if not available}"
+    "{preset|medium|Encoder preset of x264 and x265, from ultrafast to veryslow}"
+    "{crf|23|Constant rate factor of encoder when bit rate isn't set, lower for better quality}"
+    "{bitrate|0|Average bit rate of panoramic videos in kbps, 0 for constant rate factor}"
+    "{gop|60|Largest number of frames between key frames}"
+    "{encode_threads|0|Number of encoding threads of each panoramic video, 0 for automatic}"
+    "{r renditions|1|Comma separated resolution scales of panoramic videos stitched in one pass, e.g. 1,0.5,0.25}";
 }
 
 int main ( int argc, char** argv )
@@ -38,6 +56,24 @@ int main ( int argc, char** argv )
     bool stitch_pano = parser.has("pano");
     float sample_rate = parser.get<float> ( "sample" );
     bool face_detection_enabled = parser.has ( "face" );
+    int paint_thread_count = parser.get<int> ( "threads" );
+    bool scatter_paint = parser.has ( "scatter" );
+    bool stitch_yuv = parser.has ( "yuv" );
+    double preview_fps = parser.get<double> ( "preview" );
+    bool track_drift = parser.has ( "drift" );
+    EncoderSettings encoder_settings;
+    encoder_settings.codec_name = parser.get<string> ( "codec" );
+    encoder_settings.preset = parser.get<string> ( "preset" );
+    encoder_settings.crf = parser.get<int> ( "crf" );
+    encoder_settings.bit_rate = parser.get<int> ( "bitrate" ) * 1000LL;
+    encoder_settings.gop_size = parser.get<int> ( "gop" );
+    encoder_settings.thread_count = parser.get<int> ( "encode_threads" );
+    string decoder_name = parser.get<string> ( "decoder" );
+    int decode_thread_count = parser.get<int> ( "decode_threads" );
+    string remap_cache_folder = parser.get<string> ( "cache" );
+    double mesh_tolerance = parser.get<double> ( "error" );
+    string projection_name = parser.get<string> ( "projection" );
+    string rendition_scales = parser.get<string> ( "renditions" );
 
     if(stitch_pano && calibration_file.empty()) {
         cerr << "Need camera calibration file for panoramic video stitching" << endl << endl;
@@ -45,6 +81,55 @@ int main ( int argc, char** argv )
         return 0;
     }
 
+    ProjectionType projection_type = PROJECTION_EQUIRECTANGULAR;
+    if ( projection_name == "cubemap" )
+    {
+        projection_type = PROJECTION_CUBEMAP;
+    }
+    else if ( projection_name == "eac" )
+    {
+        projection_type = PROJECTION_EQUIANGULAR_CUBEMAP;
+    }
+    else if ( projection_name != "equirect" )
+    {
+        cerr << "Unknown projection " << projection_name << endl << endl;
+        parser.printMessage();
+        return 0;
+    }
+
+    if ( decoder_name != "capture" && decoder_name != "ffmpeg" )
+    {
+        cerr << "Unknown decoder " << decoder_name << endl << endl;
+        parser.printMessage();
+        return 0;
+    }
+
+    // Names full resolution video as before, and others after their scale. Repeated scales are stitched once.
+    vector<OutputRendition> renditions;
+    stringstream rendition_scales_ss ( rendition_scales );
+    string scale_text;
+    while ( getline ( rendition_scales_ss, scale_text, ',' ) )
+    {
+        double scale = atof ( scale_text.c_str() );
+        if ( scale <= 0.0 || scale > 1.0 )
+        {
+            cerr << "Rendition scale should be in (0, 1]: " << scale_text << endl << endl;
+            parser.printMessage();
+            return 0;
+        }
+        bool repeated = false;
+        for ( const OutputRendition& rendition : renditions )
+        {
+            repeated = repeated || rendition.scale == scale;
+        }
+        if ( repeated )
+        {
+            cout << "Rendition scale " << scale_text << " is repeated and stitched once." << endl;
+            continue;
+        }
+        renditions.push_back ( OutputRendition { scale == 1.0 ? "pano_video" : "pano_video_" + scale_text, scale } );
+    }
+
     if ( !parser.check() )
     {
         parser.printErrors();
@@ -56,10 +141,18 @@ int main ( int argc, char** argv )
     {
         pano_video_mapper.EnableFaceDetection();
     }
+    pano_video_mapper.SetPaintThreadCount ( paint_thread_count );
+    pano_video_mapper.SetDecodeBackend ( decoder_name == "ffmpeg" ? DECODE_BACKEND_FFMPEG : DECODE_BACKEND_VIDEO_CAPTURE, decode_thread_count );
+    pano_video_mapper.SetPaintMode ( scatter_paint ? PAINT_MODE_SCATTER : PAINT_MODE_GATHER );
+    pano_video_mapper.SetStitchColor ( stitch_yuv ? STITCH_COLOR_YUV420 : STITCH_COLOR_BGR );
+    pano_video_mapper.SetEncoderSettings ( encoder_settings );
+    pano_video_mapper.SetPreviewRate ( preview_fps );
+    pano_video_mapper.SetDriftTracking ( track_drift );
+    pano_video_mapper.SetRemapCacheFolder ( remap_cache_folder );
+    pano_video_mapper.SetMeshTolerance ( mesh_tolerance );
+    pano_video_mapper.SetOutputProjection ( projection_type );
 
     cout << endl << "Warning: Existed contents in output folder will be removed." << endl;
-    cout << "Press any key to continue." << endl;
-    waitKey(0);
 
     auto start = chrono::high_resolution_clock::now();
 
@@ -70,7 +163,7 @@ int main ( int argc, char** argv )
 
     if ( stitch_pano )
     {
-        pano_video_mapper.GeneratePano(calibration_file);
+        pano_video_mapper.GeneratePano(calibration_file, renditions);
     }
 
     auto time = chrono::high_resolution_clock::now();
@@ -0,0 +1,128 @@
+#include "audio_correlator.h"
+
+AudioCorrelator::AudioCorrelator ( const Mat& reference_samples, const int max_lag, const double sample_rate,
+                                   const double coarse_rate )
+    : _max_lag ( max ( max_lag, 0 ) )
+{
+    CV_Assert ( reference_samples.type() == CV_32FC1 && reference_samples.rows == 1 );
+    _reference_levels.push_back ( reference_samples );
+    // Keeps enough samples on the coarsest level for its peak to stand out of sidelobes.
+    double level_rate = sample_rate;
+    while ( level_rate > coarse_rate && _reference_levels.back().cols / kLevelFactor >= 16 * kPeakHalfWidth )
+    {
+        _reference_levels.push_back ( Decimate ( _reference_levels.back(), kLevelFactor ) );
+        level_rate /= kLevelFactor;
+    }
+    // Correlation through DFT is circular, so padding by the largest lag keeps lags searched from wrapping
+    // onto each other, as audio samples are no longer than reference.
+    const Mat& coarse_reference = _reference_levels.back();
+    _dft_size = getOptimalDFTSize ( coarse_reference.cols + GetMaxLag ( GetLevelCount() - 1 ) + 1 );
+    Mat padded_reference = Mat::zeros ( 1, _dft_size, CV_32FC1 );
+    coarse_reference.copyTo ( padded_reference.colRange ( 0, coarse_reference.cols ) );
+    dft ( padded_reference, _reference_spectrum );
+}
+
+AudioAlignment AudioCorrelator::Align ( const Mat& samples ) const
+{
+    CV_Assert ( samples.type() == CV_32FC1 && samples.rows == 1 );
+    vector<Mat> sample_levels ( 1, samples.colRange ( 0, min ( samples.cols, _reference_levels[0].cols ) ) );
+    for ( int level=1; level<GetLevelCount(); level++ )
+    {
+        sample_levels.push_back ( Decimate ( sample_levels.back(), kLevelFactor ) );
+    }
+
+    // Correlates all lags on the coarsest level at once, with the spectrum of audio samples conjugated.
+    int coarse_level = GetLevelCount() - 1;
+    const Mat& coarse_samples = sample_levels[coarse_level];
+    Mat padded_samples = Mat::zeros ( 1, _dft_size, CV_32FC1 );
+    coarse_samples.copyTo ( padded_samples.colRange ( 0, coarse_samples.cols ) );
+    Mat samples_spectrum, cross_spectrum, correlation;
+    dft ( padded_samples, samples_spectrum );
+    mulSpectrums ( _reference_spectrum, samples_spectrum, cross_spectrum, 0, true );
+    idft ( cross_spectrum, correlation, DFT_SCALE | DFT_REAL_OUTPUT );
+
+    // Negative lags wrap around to the end of correlation.
+    int coarse_max_lag = GetMaxLag ( coarse_level );
+    Mat lag_correlation ( 1, 2 * coarse_max_lag + 1, CV_32FC1 );
+    for ( int lag=-coarse_max_lag; lag<=coarse_max_lag; lag++ )
+    {
+        lag_correlation.at<float> ( 0, lag + coarse_max_lag ) = correlation.at<float> ( 0, ( lag + _dft_size ) % _dft_size );
+    }
+    Point peak_pos;
+    minMaxLoc ( lag_correlation, NULL, NULL, NULL, &peak_pos );
+    AudioAlignment alignment;
+    alignment.lag = peak_pos.x - coarse_max_lag;
+    // Scores the peak against all other lags searched.
+    alignment.peak_to_sidelobe = MeasurePeakToSidelobe ( lag_correlation, peak_pos.x, kPeakHalfWidth );
+
+    // Refines lag on each finer level around the lag found on the level below, which is accurate to one of its samples.
+    for ( int level=coarse_level-1; level>=0; level-- )
+    {
+        int center_lag = alignment.lag * kLevelFactor;
+        int max_level_lag = GetMaxLag ( level );
+        double best_correlation = -numeric_limits<double>::infinity();
+        for ( int lag=max ( center_lag - kLevelFactor, -max_level_lag ); lag<=min ( center_lag + kLevelFactor, max_level_lag ); lag++ )
+        {
+            double lag_correlation_value = Correlate ( _reference_levels[level], sample_levels[level], lag );
+            if ( lag_correlation_value > best_correlation )
+            {
+                best_correlation = lag_correlation_value;
+                alignment.lag = lag;
+            }
+        }
+    }
+    return alignment;
+}
+
+double AudioCorrelator::MeasurePeakToSidelobe ( const Mat& correlation, const int peak_index, const int peak_half_width )
+{
+    Mat sidelobe_mask = Mat::ones ( correlation.size(), CV_8UC1 );
+    int peak_begin = max ( peak_index - peak_half_width, 0 );
+    int peak_end = min ( peak_index + peak_half_width + 1, correlation.cols );
+    sidelobe_mask.colRange ( peak_begin, peak_end ).setTo ( 0 );
+    if ( countNonZero ( sidelobe_mask ) < 2 )
+    {
+        return 0.0;
+    }
+    Scalar sidelobe_mean, sidelobe_stddev;
+    meanStdDev ( correlation, sidelobe_mean, sidelobe_stddev, sidelobe_mask );
+    if ( sidelobe_stddev[0] <= 0.0 )
+    {
+        return 0.0;
+    }
+    return ( correlation.at<float> ( 0, peak_index ) - sidelobe_mean[0] ) / sidelobe_stddev[0];
+}
+
+Mat AudioCorrelator::Decimate ( const Mat& samples, const int factor )
+{
+    int decimated_count = samples.cols / factor;
+    if ( decimated_count == 0 )
+    {
+        return Mat ( 1, 0, CV_32FC1 );
+    }
+    Mat decimated;
+    resize ( samples.colRange ( 0, decimated_count * factor ), decimated, Size ( decimated_count, 1 ), 0, 0, INTER_AREA );
+    return decimated;
+}
+
+double AudioCorrelator::Correlate ( const Mat& reference, const Mat& samples, const int lag )
+{
+    int begin = max ( 0, -lag );
+    int end = min ( samples.cols, reference.cols - lag );
+    if ( begin >= end )
+    {
+        return 0.0;
+    }
+    return reference.colRange ( begin + lag, end + lag ).dot ( samples.colRange ( begin, end ) );
+}
+
+int AudioCorrelator::GetMaxLag ( const int level ) const
+{
+    int factor = 1;
+    for ( int i=0; i<level; i++ )
+    {
+        factor *= kLevelFactor;
+    }
+    // Rounds up so the coarse search covers the full range.
+    return ( _max_lag + factor - 1 ) / factor;
+}
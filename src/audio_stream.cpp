@@ -0,0 +1,150 @@
+#include "audio_stream.h"
+
+#include <algorithm>
+#include <cstring>
+
+AudioStream::~AudioStream()
+{
+    Close();
+}
+
+bool AudioStream::Open ( const shared_ptr<Demuxer>& demuxer, const int sample_rate )
+{
+    Close();
+    if ( !demuxer || !demuxer->IsOpened() )
+    {
+        return false;
+    }
+    AVCodec* codec = NULL;
+    int stream_index = demuxer->FindBestStream ( AVMEDIA_TYPE_AUDIO, &codec );
+    if ( stream_index < 0 )
+    {
+        cerr << "FFmpeg: Cannot find any audio stream in the file" << endl;
+        return false;
+    }
+    _demuxer = demuxer;
+    _stream_index = stream_index;
+    _demuxer->SetStreamWanted ( _stream_index, true );
+    _codec_context = avcodec_alloc_context3 ( codec );
+    if ( !_codec_context || avcodec_parameters_to_context ( _codec_context, _demuxer->GetStream ( _stream_index )->codecpar ) < 0
+            || avcodec_open2 ( _codec_context, codec, NULL ) != 0 )
+    {
+        cerr << "FFmpeg: Cannot open the context with the decoder" << endl;
+        Close();
+        return false;
+    }
+
+    // Mixes all channels down to mono float at output rate.
+    _sample_rate = sample_rate > 0 ? sample_rate : _codec_context->sample_rate;
+    int64_t channel_layout = _codec_context->channel_layout != 0 ? _codec_context->channel_layout
+                             : av_get_default_channel_layout ( _codec_context->channels );
+    _swr_context = swr_alloc_set_opts ( NULL, AV_CH_LAYOUT_MONO, AV_SAMPLE_FMT_FLT, _sample_rate, channel_layout,
+                                        _codec_context->sample_fmt, _codec_context->sample_rate, 0, NULL );
+    _frame = av_frame_alloc();
+    _packet = av_packet_alloc();
+    if ( !_swr_context || swr_init ( _swr_context ) < 0 || !_frame || !_packet )
+    {
+        cerr << "FFmpeg: Cannot create audio resampler" << endl;
+        Close();
+        return false;
+    }
+    _draining = false;
+    _flushed = false;
+    _pending_samples.clear();
+    _pending_begin = 0;
+    return true;
+}
+
+void AudioStream::Close()
+{
+    swr_free ( &_swr_context );
+    av_packet_free ( &_packet );
+    av_frame_free ( &_frame );
+    avcodec_free_context ( &_codec_context );
+    if ( _demuxer && _stream_index >= 0 )
+    {
+        _demuxer->SetStreamWanted ( _stream_index, false );
+    }
+    _demuxer.reset();
+    _stream_index = -1;
+}
+
+int AudioStream::Read ( float* samples, const int count )
+{
+    if ( !IsOpened() )
+    {
+        return 0;
+    }
+    int read_count = 0;
+    while ( read_count < count )
+    {
+        if ( _pending_begin < _pending_samples.size() )
+        {
+            int copy_count = min ( ( size_t ) ( count - read_count ), _pending_samples.size() - _pending_begin );
+            memcpy ( samples + read_count, _pending_samples.data() + _pending_begin, copy_count * sizeof ( float ) );
+            _pending_begin += copy_count;
+            read_count += copy_count;
+            continue;
+        }
+        if ( _flushed )
+        {
+            break;
+        }
+        // Converts the next frame, or flushes samples delayed in resampler at the end of stream.
+        const uint8_t** input = NULL;
+        int input_count = 0;
+        if ( DecodeFrame() )
+        {
+            input = const_cast<const uint8_t**> ( _frame->extended_data );
+            input_count = _frame->nb_samples;
+        }
+        else
+        {
+            _flushed = true;
+        }
+        int output_capacity = swr_get_out_samples ( _swr_context, input_count );
+        bool direct = output_capacity <= count - read_count;
+        if ( !direct )
+        {
+            _pending_samples.resize ( output_capacity );
+            _pending_begin = 0;
+        }
+        uint8_t* output = reinterpret_cast<uint8_t*> ( direct ? samples + read_count : _pending_samples.data() );
+        int converted = max ( swr_convert ( _swr_context, &output, output_capacity, input, input_count ), 0 );
+        if ( direct )
+        {
+            read_count += converted;
+        }
+        else
+        {
+            _pending_samples.resize ( converted );
+        }
+        av_frame_unref ( _frame );
+    }
+    return read_count;
+}
+
+bool AudioStream::DecodeFrame()
+{
+    while ( true )
+    {
+        int result = avcodec_receive_frame ( _codec_context, _frame );
+        if ( result == 0 )
+        {
+            return true;
+        }
+        if ( result != AVERROR ( EAGAIN ) || _draining )
+        {
+            return false;
+        }
+        // Feeds decoder with the next packet of audio stream, or drains it at the end of file.
+        if ( !_demuxer->ReadPacket ( _stream_index, _packet ) )
+        {
+            avcodec_send_packet ( _codec_context, NULL );
+            _draining = true;
+            continue;
+        }
+        avcodec_send_packet ( _codec_context, _packet );
+        av_packet_unref ( _packet );
+    }
+}
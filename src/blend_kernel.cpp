@@ -0,0 +1,104 @@
+#include "blend_kernel.h"
+
+#if defined ( __GNUC__ ) && ( defined ( __x86_64__ ) || defined ( __i386__ ) )
+#define BLEND_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+ushort BlendKernel::QuantizeWeight ( const double factor )
+{
+    int weight = cvRound ( factor * ( 1 << kWeightBits ) );
+    return ( ushort ) std::min ( std::max ( weight, 0 ), 1 << kWeightBits );
+}
+
+void BlendKernel::AccumulateRow ( const uchar* src, const ushort* weights, uchar* dst, const int count )
+{
+    static const AccumulateRowFunction function = SelectAccumulateRow();
+    function ( src, weights, dst, count );
+}
+
+BlendKernel::AccumulateRowFunction BlendKernel::SelectAccumulateRow()
+{
+#ifdef BLEND_KERNEL_X86
+    if ( checkHardwareSupport ( CV_CPU_AVX2 ) )
+    {
+        return &AccumulateRowAvx2;
+    }
+    if ( checkHardwareSupport ( CV_CPU_SSE4_1 ) )
+    {
+        return &AccumulateRowSse41;
+    }
+#endif
+    return &AccumulateRowScalar;
+}
+
+void BlendKernel::AccumulateRowScalar ( const uchar* src, const ushort* weights, uchar* dst, const int count )
+{
+    const int half = 1 << ( kWeightBits - 1 );
+    for ( int i=0; i<count; i++ )
+    {
+        int value = dst[i] + ( ( src[i] * weights[i] + half ) >> kWeightBits );
+        dst[i] = ( uchar ) std::min ( value, 255 );
+    }
+}
+
+#ifdef BLEND_KERNEL_X86
+
+// Products of a byte and a weight no larger than 1 << kWeightBits fit in unsigned 16 bits,
+// so both vector kernels work on 16-bit lanes and saturate when packing back to bytes.
+
+__attribute__ ( ( target ( "sse4.1" ) ) )
+void BlendKernel::AccumulateRowSse41 ( const uchar* src, const ushort* weights, uchar* dst, const int count )
+{
+    const __m128i half = _mm_set1_epi16 ( 1 << ( kWeightBits - 1 ) );
+    int i = 0;
+    for ( ; i+16<=count; i+=16 )
+    {
+        __m128i src_bytes = _mm_loadu_si128 ( ( const __m128i* ) ( src + i ) );
+        __m128i src_low = _mm_cvtepu8_epi16 ( src_bytes );
+        __m128i src_high = _mm_cvtepu8_epi16 ( _mm_srli_si128 ( src_bytes, 8 ) );
+        __m128i weight_low = _mm_loadu_si128 ( ( const __m128i* ) ( weights + i ) );
+        __m128i weight_high = _mm_loadu_si128 ( ( const __m128i* ) ( weights + i + 8 ) );
+        __m128i product_low = _mm_srli_epi16 ( _mm_add_epi16 ( _mm_mullo_epi16 ( src_low, weight_low ), half ), kWeightBits );
+        __m128i product_high = _mm_srli_epi16 ( _mm_add_epi16 ( _mm_mullo_epi16 ( src_high, weight_high ), half ), kWeightBits );
+        __m128i dst_bytes = _mm_loadu_si128 ( ( const __m128i* ) ( dst + i ) );
+        __m128i result = _mm_adds_epu8 ( dst_bytes, _mm_packus_epi16 ( product_low, product_high ) );
+        _mm_storeu_si128 ( ( __m128i* ) ( dst + i ), result );
+    }
+    AccumulateRowScalar ( src + i, weights + i, dst + i, count - i );
+}
+
+__attribute__ ( ( target ( "avx2" ) ) )
+void BlendKernel::AccumulateRowAvx2 ( const uchar* src, const ushort* weights, uchar* dst, const int count )
+{
+    const __m256i half = _mm256_set1_epi16 ( 1 << ( kWeightBits - 1 ) );
+    int i = 0;
+    for ( ; i+32<=count; i+=32 )
+    {
+        __m256i src_low = _mm256_cvtepu8_epi16 ( _mm_loadu_si128 ( ( const __m128i* ) ( src + i ) ) );
+        __m256i src_high = _mm256_cvtepu8_epi16 ( _mm_loadu_si128 ( ( const __m128i* ) ( src + i + 16 ) ) );
+        __m256i weight_low = _mm256_loadu_si256 ( ( const __m256i* ) ( weights + i ) );
+        __m256i weight_high = _mm256_loadu_si256 ( ( const __m256i* ) ( weights + i + 16 ) );
+        __m256i product_low = _mm256_srli_epi16 ( _mm256_add_epi16 ( _mm256_mullo_epi16 ( src_low, weight_low ), half ), kWeightBits );
+        __m256i product_high = _mm256_srli_epi16 ( _mm256_add_epi16 ( _mm256_mullo_epi16 ( src_high, weight_high ), half ), kWeightBits );
+        // Packing works within 128-bit lanes, so restores byte order across lanes afterwards.
+        __m256i packed = _mm256_permute4x64_epi64 ( _mm256_packus_epi16 ( product_low, product_high ), 0xD8 );
+        __m256i dst_bytes = _mm256_loadu_si256 ( ( const __m256i* ) ( dst + i ) );
+        _mm256_storeu_si256 ( ( __m256i* ) ( dst + i ), _mm256_adds_epu8 ( dst_bytes, packed ) );
+    }
+    AccumulateRowScalar ( src + i, weights + i, dst + i, count - i );
+}
+
+#else
+
+void BlendKernel::AccumulateRowSse41 ( const uchar* src, const ushort* weights, uchar* dst, const int count )
+{
+    AccumulateRowScalar ( src, weights, dst, count );
+}
+
+void BlendKernel::AccumulateRowAvx2 ( const uchar* src, const ushort* weights, uchar* dst, const int count )
+{
+    AccumulateRowScalar ( src, weights, dst, count );
+}
+
+#endif
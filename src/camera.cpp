@@ -1,5 +1,10 @@
 #include "camera.h"
 
+#if defined ( __SSE2__ )
+#define CAMERA_SSE2
+#include <emmintrin.h>
+#endif
+
 Camera::Camera ( const string& name, const int width, const int height, const double u0, const double v0,
                  const vector< double >& affine, const vector< double >& poly, const vector< double >& inv_poly,
                  const vector< double >& extrinsic )
@@ -9,60 +14,174 @@ Camera::Camera ( const string& name, const int width, const int height, const do
     _transform_4_4 = Mat::eye ( 4, 4, CV_64FC1 );
     Utils::GetTransform44FromExtrinsic ( extrinsic, &_transform_4_4 );
     _transform_4_4.col ( 3 ).rowRange ( 0, 3 ) *= 0.0;
+    // Keeps rotation and its inverse as plain arrays for projection kernels.
+    Mat inverse_transform_4_4 = _transform_4_4.inv();
+    for ( int i=0; i<3; i++ )
+    {
+        for ( int j=0; j<3; j++ )
+        {
+            _rotation[3*i+j] = _transform_4_4.at<double> ( i, j );
+            _inverse_rotation[3*i+j] = inverse_transform_4_4.at<double> ( i, j );
+        }
+    }
 }
 
 Mat Camera::ProjectWorldToFrame ( const Mat& world_pts, const bool debug ) const
 {
-    CV_Assert ( world_pts.cols == 3 );
-    Mat world_pts_n_4 = Mat::ones ( world_pts.rows, 4, world_pts.type() );
-    world_pts.copyTo ( world_pts_n_4.colRange ( 0, 3 ) );
-    Mat camera_pts_n_4 = world_pts_n_4 * _transform_4_4.inv().t();
-    Mat frame_pts_n_2 ( camera_pts_n_4.rows, 2, CV_64FC1 );
+    CV_Assert ( world_pts.cols == 3 && world_pts.type() == CV_64FC1 );
+    Mat continuous_world_pts = world_pts.isContinuous() ? world_pts : world_pts.clone();
+    Mat frame_pts_n_2 ( world_pts.rows, 2, CV_64FC1 );
 
     if ( debug )
     {
-        cout << world_pts_n_4 << endl;
-        cout << camera_pts_n_4 << endl;
+        cout << world_pts << endl;
         cout << _transform_4_4 << endl;
     }
 
-    for ( int i=0; i<camera_pts_n_4.rows; i++ )
+    ProjectWorldToFrame ( continuous_world_pts.ptr<double> (), world_pts.rows, frame_pts_n_2.ptr<double> () );
+    return frame_pts_n_2;
+}
+
+void Camera::ProjectWorldToFrame ( const double* world_pts, const int count, double* frame_pts ) const
+{
+    const int block_size = 64;
+    double xs[block_size], ys[block_size], zs[block_size], norms[block_size], thetas[block_size], rhos[block_size];
+    const double* coefficients = _inverse_poly.data();
+    const int n = _inverse_poly.size();
+    const double* r = _inverse_rotation;
+    for ( int start=0; start<count; start+=block_size )
     {
-        ProjectCameraToFrame ( camera_pts_n_4.row ( i ) ).copyTo ( frame_pts_n_2.row ( i ) );
+        int block_count = min ( block_size, count - start );
+        const double* block_world_pts = world_pts + 3 * start;
+        double* block_frame_pts = frame_pts + 2 * start;
+        // Rotates points to camera coordinates system and calculates their angles to xy plane.
+        for ( int k=0; k<block_count; k++ )
+        {
+            const double* pt = block_world_pts + 3 * k;
+            xs[k] = r[0] * pt[0] + r[1] * pt[1] + r[2] * pt[2];
+            ys[k] = r[3] * pt[0] + r[4] * pt[1] + r[5] * pt[2];
+            zs[k] = r[6] * pt[0] + r[7] * pt[1] + r[8] * pt[2];
+            norms[k] = sqrt ( xs[k] * xs[k] + ys[k] * ys[k] );
+            if ( norms[k] == 0.0 )
+            {
+                norms[k] = 1e-14;
+            }
+            thetas[k] = atan2 ( -zs[k], norms[k] );
+        }
+        // Evaluates inverse polynomial of the whole block with Horner's method, one coefficient at a time,
+        // two points per SSE2 vector. Multiplies and adds are kept separate, so lanes round as the scalar tail.
+        for ( int k=0; k<block_count; k++ )
+        {
+            rhos[k] = n > 0 ? coefficients[n-1] : 0.0;
+        }
+        for ( int power=n-2; power>=0; power-- )
+        {
+            int k = 0;
+#ifdef CAMERA_SSE2
+            const __m128d coefficient = _mm_set1_pd ( coefficients[power] );
+            for ( ; k+2<=block_count; k+=2 )
+            {
+                __m128d rho = _mm_mul_pd ( _mm_loadu_pd ( rhos + k ), _mm_loadu_pd ( thetas + k ) );
+                _mm_storeu_pd ( rhos + k, _mm_add_pd ( rho, coefficient ) );
+            }
+#endif
+            for ( ; k<block_count; k++ )
+            {
+                rhos[k] = rhos[k] * thetas[k] + coefficients[power];
+            }
+        }
+        // Affines points on frame. Points behind camera are marked invalid.
+        for ( int k=0; k<block_count; k++ )
+        {
+            double* frame_pt = block_frame_pts + 2 * k;
+            if ( zs[k] < 0.0 )
+            {
+                frame_pt[0] = frame_pt[1] = numeric_limits<double>().max();
+                continue;
+            }
+            double u = xs[k] * rhos[k] / norms[k];
+            double v = ys[k] * rhos[k] / norms[k];
+            frame_pt[0] = _c * u + _d * v + _u0;
+            frame_pt[1] = _e * u + v + _v0;
+        }
     }
-
-    return frame_pts_n_2;
 }
 
-Mat Camera::ProjectCameraToFrame ( const Mat& camera_pt ) const
+Point3d Camera::ProjectFrameToWorld ( const Point2d& frame_pt ) const
 {
-    CV_Assert ( camera_pt.cols >= 3 );
+    // Inverts affine on frame.
+    double inverse_det = 1.0 / ( _c - _d * _e );
+    double x = frame_pt.x - _u0;
+    double y = frame_pt.y - _v0;
+    double u = inverse_det * ( x - _d * y );
+    double v = inverse_det * ( -_e * x + _c * y );
+    // Calculates ray in camera coordinates system from its angle to the xy plane.
+    double rho = sqrt ( u*u + v*v );
+    double camera_pt[3] = { 0.0, 0.0, 1.0 };
+    if ( rho > 0.0 )
+    {
+        double theta = SolveThetaFromRho ( rho );
+        camera_pt[0] = u / rho * cos ( theta );
+        camera_pt[1] = v / rho * cos ( theta );
+        camera_pt[2] = -sin ( theta );
+    }
+    // Rotates ray from camera coordinates system to world.
+    const double* r = _rotation;
+    return Point3d ( r[0] * camera_pt[0] + r[1] * camera_pt[1] + r[2] * camera_pt[2],
+                     r[3] * camera_pt[0] + r[4] * camera_pt[1] + r[5] * camera_pt[2],
+                     r[6] * camera_pt[0] + r[7] * camera_pt[1] + r[8] * camera_pt[2] );
+}
 
-    // Gets x y z from matrix.
-    double x = camera_pt.at<double> ( 0, 0 );
-    double y = camera_pt.at<double> ( 0, 1 );
-    double z = camera_pt.at<double> ( 0, 2 );
-    // Result matrix.
-    Mat frame_pt ( 1, 2, CV_64FC1, numeric_limits<double>().max() );
-    // If point is behind camera, return invalid result.
-    if ( z < 0.0 )
+double Camera::SolveThetaFromRho ( const double rho ) const
+{
+    // Inverse polynomial increases from theta -pi/2 (optical axis) to 0 (xy plane).
+    double low = -M_PI / 2.0;
+    double high = 0.0;
+    if ( rho <= Utils::EvaluatePolyEquation ( _inverse_poly.data(), _inverse_poly.size(), low ) )
     {
-        return frame_pt;
+        return low;
     }
-    // Calculates norm on xy plane.
-    double norm_on_xy = sqrt ( x*x + y*y );
-    if ( norm_on_xy == 0.0 )
+    if ( rho >= Utils::EvaluatePolyEquation ( _inverse_poly.data(), _inverse_poly.size(), high ) )
     {
-        norm_on_xy = 1e-14;
+        return high;
     }
-    // Calculates projected position on the frame.
-    double theta = atan2 ( -z, norm_on_xy );
-    double rho = Utils::EvaluatePolyEquation ( _inverse_poly.data(), _inverse_poly.size(), theta );
-    // u, v of corner on frame without affine.
-    double u = x * rho / norm_on_xy;
-    double v = y * rho / norm_on_xy;
-    // Affines corner on frame.
-    frame_pt.at<double> ( 0, 0 ) = _c * u + _d * v + _u0;
-    frame_pt.at<double> ( 0, 1 ) = _e * u + v + _v0;
-    return frame_pt;
+    // Forward polynomial gives the initial guess. It is only fitted within the calibrated radius,
+    // so the angle is refined against the inverse polynomial used by ProjectWorldToFrame.
+    double theta = atan2 ( Utils::EvaluatePolyEquation ( _poly.data(), _poly.size(), rho ), rho );
+    for ( int i=0; i<50; i++ )
+    {
+        if ( theta <= low || theta >= high )
+        {
+            theta = 0.5 * ( low + high );
+        }
+        double error = Utils::EvaluatePolyEquation ( _inverse_poly.data(), _inverse_poly.size(), theta ) - rho;
+        if ( fabs ( error ) < 1e-6 )
+        {
+            break;
+        }
+        if ( error < 0.0 )
+        {
+            low = theta;
+        }
+        else
+        {
+            high = theta;
+        }
+        // Newton step, falls back to bisection when it leaves the bracket.
+        double derivative = Utils::EvaluatePolyDerivative ( _inverse_poly.data(), _inverse_poly.size(), theta );
+        theta = derivative > 0.0 ? theta - error / derivative : 0.5 * ( low + high );
+    }
+    return theta;
+}
+
+uint64_t Camera::GetParameterHash() const
+{
+    vector<double> parameters = { ( double ) _width, ( double ) _height, _u0, _v0, _c, _d, _e };
+    parameters.insert ( parameters.end(), _poly.begin(), _poly.end() );
+    parameters.push_back ( _poly.size() );
+    parameters.insert ( parameters.end(), _inverse_poly.begin(), _inverse_poly.end() );
+    parameters.push_back ( _inverse_poly.size() );
+    parameters.insert ( parameters.end(), _transform_4_4.begin<double>(), _transform_4_4.end<double>() );
+    uint64_t hash = Utils::HashBytes ( _name.data(), _name.size() );
+    return Utils::HashBytes ( parameters.data(), parameters.size() * sizeof ( double ), hash );
 }
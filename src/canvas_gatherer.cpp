@@ -0,0 +1,222 @@
+#include "canvas_gatherer.h"
+
+namespace
+{
+// Contribution of one camera to one pixel of a canvas row.
+struct Contribution
+{
+    int p_x;
+    int camera_index;
+    short frame_x;
+    short frame_y;
+    ushort weight;
+};
+}
+
+CanvasGatherer::CanvasGatherer ( const vector<const FrameMapper*>& frame_mappers )
+{
+    CV_Assert ( !frame_mappers.empty() );
+    _output_size = frame_mappers[0]->GetOutputSize();
+    int width = _output_size.width;
+    int height = _output_size.height;
+    int camera_count = frame_mappers.size();
+    for ( const FrameMapper* frame_mapper : frame_mappers )
+    {
+        CV_Assert ( frame_mapper->GetOutputSize() == _output_size );
+        _frame_sizes.push_back ( frame_mapper->GetFrameSize() );
+    }
+
+    // Remap entries of every mapper are ordered in canvas, so one cursor per mapper walks them row by row.
+    vector<int> copy_cursors ( camera_count, 0 );
+    vector<int> blend_cursors ( camera_count, 0 );
+    vector<Contribution> row_contributions;
+    _span_row_begins.assign ( height + 1, 0 );
+    _blend_pixel_begins.assign ( 1, 0 );
+    for ( int p_y=0; p_y<height; p_y++ )
+    {
+        _span_row_begins[p_y] = _spans.size();
+        // Collects contributions to the row camera by camera, then orders them by pixel keeping camera order.
+        row_contributions.clear();
+        int row_end = ( p_y + 1 ) * width;
+        for ( int c=0; c<camera_count; c++ )
+        {
+            const RemapTable& copy_sources = frame_mappers[c]->GetCopySources();
+            for ( int& i=copy_cursors[c]; i<copy_sources.Size() && copy_sources.canvas_offsets[i]<row_end; i++ )
+            {
+                Contribution contribution = { copy_sources.canvas_offsets[i] - p_y * width, c,
+                                              copy_sources.frame_xs[i], copy_sources.frame_ys[i], kCopyWeight
+                                            };
+                row_contributions.push_back ( contribution );
+            }
+            const RemapTable& blend_sources = frame_mappers[c]->GetBlendSources();
+            const vector<ushort>& blend_weights = frame_mappers[c]->GetBlendWeights();
+            for ( int& i=blend_cursors[c]; i<blend_sources.Size() && blend_sources.canvas_offsets[i]<row_end; i++ )
+            {
+                Contribution contribution = { blend_sources.canvas_offsets[i] - p_y * width, c,
+                                              blend_sources.frame_xs[i], blend_sources.frame_ys[i], blend_weights[3 * i]
+                                            };
+                row_contributions.push_back ( contribution );
+            }
+        }
+        stable_sort ( row_contributions.begin(), row_contributions.end(), [] ( const Contribution& a, const Contribution& b )
+        {
+            return a.p_x < b.p_x;
+        } );
+
+        // Classifies each pixel of the row, extending last run if pixel is gathered the same way.
+        size_t k = 0;
+        for ( int p_x=0; p_x<width; p_x++ )
+        {
+            size_t k_end = k;
+            while ( k_end < row_contributions.size() && row_contributions[k_end].p_x == p_x )
+            {
+                k_end++;
+            }
+            GatherKind kind = GATHER_KIND_BLEND;
+            int camera_index = -1;
+            if ( k_end == k )
+            {
+                kind = GATHER_KIND_UNCOVERED;
+            }
+            else if ( k_end == k + 1 && row_contributions[k].weight == kCopyWeight )
+            {
+                kind = GATHER_KIND_COPY;
+                camera_index = row_contributions[k].camera_index;
+            }
+            if ( p_x == 0 || _spans.back().kind != kind || _spans.back().camera_index != camera_index )
+            {
+                GatherSpan span;
+                span.canvas_offset = p_y * width + p_x;
+                span.pixel_count = 0;
+                span.kind = kind;
+                span.camera_index = camera_index;
+                span.first_index = kind == GATHER_KIND_COPY ? _copy_xs.size() : _blend_pixel_begins.size() - 1;
+                _spans.push_back ( span );
+            }
+            _spans.back().pixel_count++;
+            if ( kind == GATHER_KIND_COPY )
+            {
+                _copy_xs.push_back ( row_contributions[k].frame_x );
+                _copy_ys.push_back ( row_contributions[k].frame_y );
+            }
+            else if ( kind == GATHER_KIND_BLEND )
+            {
+                for ( size_t i=k; i<k_end; i++ )
+                {
+                    _contribution_cameras.push_back ( row_contributions[i].camera_index );
+                    _contribution_xs.push_back ( row_contributions[i].frame_x );
+                    _contribution_ys.push_back ( row_contributions[i].frame_y );
+                    _contribution_weights.push_back ( row_contributions[i].weight );
+                }
+                _blend_pixel_begins.push_back ( _contribution_cameras.size() );
+            }
+            k = k_end;
+        }
+    }
+    _span_row_begins[height] = _spans.size();
+}
+
+void CanvasGatherer::PaintOnCanvas ( const vector<Mat>& frames, Mat* canvas, const int row_begin, const int row_end,
+                                     const uchar fill_value ) const
+{
+    CV_Assert ( frames.size() == _frame_sizes.size() );
+    CV_Assert ( ( canvas->type() == CV_8UC3 || canvas->type() == CV_8UC1 ) && canvas->size() == _output_size && canvas->isContinuous() );
+    for ( unsigned c=0; c<frames.size(); c++ )
+    {
+        CV_Assert ( frames[c].empty() || ( frames[c].type() == canvas->type() && frames[c].size() == _frame_sizes[c] ) );
+    }
+    CV_Assert ( 0 <= row_begin && row_begin <= row_end && row_end <= _output_size.height );
+    if ( canvas->channels() == 3 )
+    {
+        PaintPixels<3> ( frames, canvas, row_begin, row_end, fill_value );
+    }
+    else
+    {
+        PaintPixels<1> ( frames, canvas, row_begin, row_end, fill_value );
+    }
+}
+
+template<int channels>
+void CanvasGatherer::PaintPixels ( const vector<Mat>& frames, Mat* canvas, const int row_begin, const int row_end,
+                                   const uchar fill_value ) const
+{
+    uchar* canvas_data = canvas->ptr<uchar> ();
+    // Blended runs are accumulated in chunks, one contribution of every pixel at a time.
+    const int chunk_size = 256;
+    uchar gathered[channels * chunk_size];
+    ushort gathered_weights[channels * chunk_size];
+    for ( int i=_span_row_begins[row_begin]; i<_span_row_begins[row_end]; i++ )
+    {
+        const GatherSpan& span = _spans[i];
+        uchar* target = canvas_data + channels * span.canvas_offset;
+        if ( span.kind == GATHER_KIND_COPY && !frames[span.camera_index].empty() )
+        {
+            const Mat& frame = frames[span.camera_index];
+            const short* source_xs = &_copy_xs[span.first_index];
+            const short* source_ys = &_copy_ys[span.first_index];
+            for ( int k=0; k<span.pixel_count; k++ )
+            {
+                const uchar* source = frame.ptr<uchar> ( source_ys[k] ) + channels * source_xs[k];
+                for ( int channel=0; channel<channels; channel++ )
+                {
+                    target[channels * k + channel] = source[channel];
+                }
+            }
+        }
+        else if ( span.kind == GATHER_KIND_BLEND )
+        {
+            // Applies contributions in camera order as painting mappers one after another would. The n-th
+            // contribution of every pixel of a chunk is accumulated by the blend kernel at once, and pixels
+            // without one add nothing. A copy contribution clears the pixel and adds its source at full weight,
+            // which the kernel reproduces exactly. Contributions of cameras without frame add fill value at
+            // their weight, so blended pixels fall back to fill value like copied runs.
+            for ( int start=0; start<span.pixel_count; start+=chunk_size )
+            {
+                int count = min ( chunk_size, span.pixel_count - start );
+                const int* pixel_begins = &_blend_pixel_begins[span.first_index + start];
+                uchar* chunk_target = target + channels * start;
+                memset ( chunk_target, 0, channels * count );
+                for ( int layer=0; ; layer++ )
+                {
+                    bool has_layer = false;
+                    for ( int k=0; k<count; k++ )
+                    {
+                        int j = pixel_begins[k] + layer;
+                        ushort weight = 0;
+                        const uchar* source = NULL;
+                        if ( j < pixel_begins[k + 1] )
+                        {
+                            has_layer = true;
+                            const Mat& frame = frames[_contribution_cameras[j]];
+                            if ( !frame.empty() )
+                            {
+                                source = frame.ptr<uchar> ( _contribution_ys[j] ) + channels * _contribution_xs[j];
+                            }
+                            weight = _contribution_weights[j];
+                        }
+                        if ( weight == kCopyWeight )
+                        {
+                            memset ( chunk_target + channels * k, 0, channels );
+                            weight = 1 << BlendKernel::kWeightBits;
+                        }
+                        for ( int channel=0; channel<channels; channel++ )
+                        {
+                            gathered[channels * k + channel] = source != NULL ? source[channel] : fill_value;
+                            gathered_weights[channels * k + channel] = weight;
+                        }
+                    }
+                    if ( !has_layer )
+                    {
+                        break;
+                    }
+                    BlendKernel::AccumulateRow ( gathered, gathered_weights, chunk_target, channels * count );
+                }
+            }
+        }
+        else
+        {
+            // Uncovered runs, and copied runs of cameras without frame, are filled.
+            memset ( target, fill_value, channels * span.pixel_count );
+        }
+    }
+}
@@ -1,4 +1,18 @@
 #include "combined_video_clip.h"
+#include "drift_tracker.h"
+
+#include <unistd.h>
+
+#include <cmath>
+#include <cstdio>
+#include <iomanip>
+#include <sstream>
+
+namespace
+{
+// Peak to sidelobe ratio of audio correlation below which synchronization is reported as unreliable.
+const double kMinPeakToSidelobe = 5.0;
+}
 
 void CombinedVideoClip::ReadSynchParametersFromFile ( const string& file_name, SynchParameters* parameters )
 {
@@ -33,13 +47,24 @@ void CombinedVideoClip::ReadSynchParametersFromFile ( const string& file_name, S
         {
             parameters->time_offset.push_back ( ( double ) ( *video_file_iterator ) ["Offset"] );
         }
+        TimeMap time_map;
+        FileNode time_map_node = ( *video_file_iterator ) ["TimeMap"];
+        for ( int k=0; k+1<( int ) time_map_node.size(); k+=2 )
+        {
+            time_map.AddKnot ( ( double ) time_map_node[k], ( double ) time_map_node[k + 1] );
+        }
+        parameters->time_maps.push_back ( time_map );
     }
     file_storage.release();
 }
 
-void CombinedVideoClip::SaveSynchronizationResult ( const string& file_name )
+bool CombinedVideoClip::SaveSynchronizationResult ( const string& file_name )
 {
     FileStorage file_storage ( file_name, FileStorage::WRITE );
+    if ( !file_storage.isOpened() )
+    {
+        return false;
+    }
     file_storage << "Videos" << "[";
     for ( unsigned i=0; i<video_clip_vector_.size(); i++ )
     {
@@ -48,11 +73,22 @@ void CombinedVideoClip::SaveSynchronizationResult ( const string& file_name )
         file_storage << "CameraName" << clip->GetCameraName();
         file_storage << "File" << clip->GetFileName();
         file_storage << "Offset" << clip->GetShiftInSeconds();
+        // Knots of time map are stored flat as global time and shift in turn.
+        if ( !clip->GetTimeMap().IsEmpty() )
+        {
+            file_storage << "TimeMap" << "[:";
+            for ( const Point2d& knot : clip->GetTimeMap().GetKnots() )
+            {
+                file_storage << knot.x << knot.y;
+            }
+            file_storage << "]";
+        }
         file_storage << "}";
     }
     file_storage << "]";
     file_storage << "MaxShift" << parameters_.shift_window;
     file_storage.release();
+    return true;
 }
 
 void CombinedVideoClip::LoadVideosWithFileNames ( const bool synchronized )
@@ -68,6 +104,9 @@ void CombinedVideoClip::LoadVideosWithFileNames ( const bool synchronized )
         exit ( -1 );
     }
     video_count_ = parameters_.video_file_vector.size();
+    // Splits decoding threads between clips, as all of them decode at the same time.
+    int decode_thread_count = decode_thread_count_ > 0 ? decode_thread_count_ : thread::hardware_concurrency();
+    int clip_decode_thread_count = max ( 1, decode_thread_count / video_count_ );
     video_clip_vector_.clear();
     video_clip_vector_.resize ( video_count_ );
     for ( int i=0; i<video_count_; i++ )
@@ -79,78 +118,261 @@ void CombinedVideoClip::LoadVideosWithFileNames ( const bool synchronized )
         }
         video_clip_vector_[i] = VideoClip ( parameters_.video_file_vector[i], parameters_.camera_name_vector[i] );
         video_clip_vector_[i].SetShiftInSeconds ( parameters_.time_offset[i] );
+        if ( i < ( int ) parameters_.time_maps.size() )
+        {
+            video_clip_vector_[i].SetTimeMap ( parameters_.time_maps[i] );
+        }
+        video_clip_vector_[i].SetReadMode ( read_mode_ );
+        video_clip_vector_[i].SetDecodeBackend ( decode_backend_, clip_decode_thread_count );
     }
 
     synchronized_ = synchronized;
 }
 
-void CombinedVideoClip::SynchronizeVideoWithAudio ()
+void CombinedVideoClip::SynchronizeVideoWithAudio ( const string& cache_folder )
 {
     if ( video_count_ < 2 )
     {
         cerr << "Synchronization can only be performed between 2 or more videos." << endl;
         exit ( -1 );
     }
+    string cache_file;
+    if ( !cache_folder.empty() )
+    {
+        stringstream cache_file_ss;
+        cache_file_ss << Utils::EnsureTrailingSlash ( cache_folder ) << "synch_" << hex << setfill ( '0' ) << setw ( 16 )
+                      << ComputeSynchronizationKey() << ".yaml";
+        cache_file = cache_file_ss.str();
+        if ( LoadSynchronizationResult ( cache_file ) )
+        {
+            cout << "\tLoaded synchronization result from cache " << cache_file << endl;
+            for ( VideoClip& video_clip : video_clip_vector_ )
+            {
+                cout << "\t" << video_clip.GetShiftInSeconds() << " seconds: " << video_clip.GetFileName() << endl;
+                PrintDrift ( video_clip );
+            }
+            return;
+        }
+    }
 
-    // Load audio samples from all videos
-    vector<Mat> audio_samples;
+    // Loads audio samples from all videos at once, each on its own thread, at one rate for all videos.
+    // Workers only report success, and all of them are joined before any failure ends the run.
+    int sample_rate = audio_sample_rate_ > 0 ? audio_sample_rate_ : video_clip_vector_[0].ProbeAudioSampleRate();
+    vector<Mat> audio_samples ( video_count_ );
+    vector<char> extracted ( video_count_, false );
     double sample_window = parameters_.shift_window * 2;
+    vector<thread> extract_threads;
     for ( int i=0; i<video_count_; i++ )
     {
-        Mat samples;
-        VideoClip* video_clip = &video_clip_vector_[i];
-        if ( !video_clip->ExtractAudioSamples ( &samples, sample_window ) )
+        extract_threads.emplace_back ( [this, i, sample_window, sample_rate, &audio_samples, &extracted]
+        {
+            extracted[i] = video_clip_vector_[i].ExtractAudioSamples ( &audio_samples[i], sample_window, sample_rate );
+        } );
+    }
+    for ( int i=0; i<video_count_; i++ )
+    {
+        extract_threads[i].join();
+    }
+    for ( int i=0; i<video_count_; i++ )
+    {
+        if ( !extracted[i] )
         {
-            cerr << "Cannot read audio samples from video " << i << endl;
+            cerr << "Cannot read audio samples from video file: " << video_clip_vector_[i].GetFileName() << endl;
+            for ( VideoClip& video_clip : video_clip_vector_ )
+            {
+                video_clip.CloseAudio();
+            }
             exit ( -1 );
         }
-        audio_samples.push_back ( samples );
     }
 
-    // Calculates time shifts relative to the first video.
+    // Calculates time shifts relative to the first video, whose spectrum is computed once for all others.
     video_clip_vector_[0].SetShiftInSeconds ( 0.0 );
+    AudioCorrelator correlator ( audio_samples[0], cvRound ( parameters_.shift_window * sample_rate ), sample_rate );
     double max_leading = 0.0;
     for ( int i=1; i<video_count_; i++ )
     {
-        double leading = SynchronizeToReference ( audio_samples[0], audio_samples[i], &video_clip_vector_[i] );
+        double leading = SynchronizeToReference ( correlator, audio_samples[i], &video_clip_vector_[i] );
         max_leading = min ( max_leading, leading );
     }
 
+    // Follows drift of each clock over whole videos, starting from the shifts found and continuing audio
+    // streams after the samples already read. Video packets are no longer kept meanwhile, as audio is read
+    // through whole files, and video is read again from storage once decoded.
+    if ( track_drift_ )
+    {
+        cout << "\tTracking clock drift of input videos." << endl;
+        for ( VideoClip& video_clip : video_clip_vector_ )
+        {
+            video_clip.StopKeepingVideoPackets();
+        }
+        DriftTracker drift_tracker ( video_clip_vector_[0].GetAudioStream(), audio_samples[0] );
+        for ( int i=1; i<video_count_; i++ )
+        {
+            drift_tracker.AddClip ( video_clip_vector_[i].GetAudioStream(), audio_samples[i],
+                                    cvRound ( video_clip_vector_[i].GetShiftInSeconds() * sample_rate ) );
+        }
+        drift_tracker.Track();
+        for ( int i=1; i<video_count_; i++ )
+        {
+            video_clip_vector_[i].SetTimeMap ( drift_tracker.GetTimeMap ( i - 1 ) );
+        }
+    }
+    for ( VideoClip& video_clip : video_clip_vector_ )
+    {
+        video_clip.CloseAudio();
+    }
+
     // Offsets all time shift relative to the first started video.
     for ( int i=0; i<video_count_; i++ )
     {
         VideoClip* video_clip = &video_clip_vector_[i];
         video_clip->SetShiftInSeconds ( video_clip->GetShiftInSeconds() - max_leading );
+        TimeMap time_map = video_clip->GetTimeMap();
+        time_map.AddOffset ( -max_leading );
+        video_clip->SetTimeMap ( time_map );
         cout << "\t" << video_clip->GetShiftInSeconds() << " seconds: " << video_clip->GetFileName() << endl;
+        PrintDrift ( *video_clip );
     }
 
     synchronized_ = true;
+
+    // Saves to a temporary file of this process renamed afterwards, so concurrent runs never load a partial
+    // result. A file failing to be written or renamed is removed instead of being left behind.
+    if ( !cache_file.empty() )
+    {
+        Utils::CreateFolderIfNotExists ( cache_folder );
+        string temporary_file = cache_file + "." + to_string ( getpid() ) + ".tmp.yaml";
+        bool saved = false;
+        try
+        {
+            saved = SaveSynchronizationResult ( temporary_file );
+        }
+        catch ( const cv::Exception& )
+        {
+            saved = false;
+        }
+        if ( saved && rename ( temporary_file.c_str(), cache_file.c_str() ) == 0 )
+        {
+            cout << "\tSaved synchronization result to cache " << cache_file << endl;
+        }
+        else
+        {
+            remove ( temporary_file.c_str() );
+            cerr << "\tCannot save synchronization cache " << cache_file << endl;
+        }
+    }
+}
+
+bool CombinedVideoClip::LoadSynchronizationResult ( const string& file_name )
+{
+    if ( !Utils::FileExists ( file_name ) )
+    {
+        return false;
+    }
+    // OpenCV throws on a truncated or malformed file, and time maps on knots out of order, which are all
+    // treated as a cache miss instead of aborting.
+    SynchParameters parameters;
+    try
+    {
+        ReadSynchParametersFromFile ( file_name, &parameters );
+    }
+    catch ( const cv::Exception& )
+    {
+        cerr << "\tIgnoring malformed synchronization cache " << file_name << endl;
+        return false;
+    }
+    if ( parameters.video_file_vector != parameters_.video_file_vector || parameters.camera_name_vector != parameters_.camera_name_vector
+            || ( int ) parameters.time_offset.size() != video_count_ || ( int ) parameters.time_maps.size() != video_count_ )
+    {
+        return false;
+    }
+    for ( int i=0; i<video_count_; i++ )
+    {
+        bool finite = std::isfinite ( parameters.time_offset[i] );
+        for ( const Point2d& knot : parameters.time_maps[i].GetKnots() )
+        {
+            finite = finite && std::isfinite ( knot.x ) && std::isfinite ( knot.y );
+        }
+        if ( !finite )
+        {
+            return false;
+        }
+    }
+    for ( int i=0; i<video_count_; i++ )
+    {
+        video_clip_vector_[i].SetShiftInSeconds ( parameters.time_offset[i] );
+        video_clip_vector_[i].SetTimeMap ( parameters.time_maps[i] );
+    }
+    synchronized_ = true;
+    return true;
 }
 
-vector< Mat > CombinedVideoClip::ReadFramesVector ( const double global_time, const bool to_gray )
+void CombinedVideoClip::ReadFramesVector ( const double global_time, const bool to_gray, vector<Mat>* frames )
 {
     if ( !synchronized_ )
     {
         cerr << "Videos has not synchronized." << endl;
         exit ( -1 );
     }
-    vector<Mat> frames ( video_count_ );
+    frames->resize ( video_count_ );
+    frame_buffers_.resize ( video_count_ );
+    gray_buffers_.resize ( video_count_ );
     for ( int i=0; i<video_count_; i++ )
     {
         VideoClip* video_clip = &video_clip_vector_[i];
-        Mat frame = video_clip->ReadSynchedFrame ( global_time );
-        if ( !to_gray || frame.empty() || frame.channels() == 1 )
+        if ( !video_clip->ReadSynchedFrame ( global_time, &frame_buffers_[i] ) )
         {
-            frames[i] = frame;
+            ( *frames ) [i] = Mat();
+        }
+        else if ( !to_gray || frame_buffers_[i].channels() == 1 )
+        {
+            ( *frames ) [i] = frame_buffers_[i];
         }
         else
         {
-            Mat grayscale;
-            cvtColor ( frame, grayscale, CV_BGR2GRAY );
-            frames[i] = grayscale;
+            cvtColor ( frame_buffers_[i], gray_buffers_[i], CV_BGR2GRAY );
+            ( *frames ) [i] = gray_buffers_[i];
         }
     }
-    return frames;
+}
+
+uint64_t CombinedVideoClip::ComputeSynchronizationKey ()
+{
+    vector<uint64_t> values = { ( uint64_t ) kSynchronizationVersion, ( uint64_t ) audio_sample_rate_, ( uint64_t ) track_drift_ };
+    values.push_back ( Utils::HashBytes ( &parameters_.shift_window, sizeof ( parameters_.shift_window ) ) );
+    for ( int i=0; i<video_count_; i++ )
+    {
+        const string& camera_name = parameters_.camera_name_vector[i];
+        values.push_back ( Utils::HashFileIdentity ( parameters_.video_file_vector[i],
+                           Utils::HashBytes ( camera_name.data(), camera_name.size() ) ) );
+    }
+    return Utils::HashBytes ( values.data(), values.size() * sizeof ( uint64_t ) );
+}
+
+void CombinedVideoClip::PrintDrift ( VideoClip& video_clip )
+{
+    const vector<Point2d>& knots = video_clip.GetTimeMap().GetKnots();
+    if ( !knots.empty() )
+    {
+        cout << "\t\tDrifts " << ( knots.back().y - knots.front().y ) * 1000.0 << " ms from " << knots.front().x << " to "
+             << knots.back().x << " seconds, over " << knots.size() << " knots." << endl;
+    }
+}
+
+vector<vector<Mat>> CombinedVideoClip::ReadPlanesVector ( const double global_time )
+{
+    if ( !synchronized_ )
+    {
+        cerr << "Videos has not synchronized." << endl;
+        exit ( -1 );
+    }
+    vector<vector<Mat>> planes ( video_count_ );
+    for ( int i=0; i<video_count_; i++ )
+    {
+        video_clip_vector_[i].ReadSynchedPlanes ( global_time, &planes[i] );
+    }
+    return planes;
 }
 
 void CombinedVideoClip::ViewSynchronizedVideos()
@@ -197,17 +419,15 @@ void CombinedVideoClip::ViewSynchronizedVideos()
     }
 }
 
-double CombinedVideoClip::SynchronizeToReference ( const Mat& reference_samples, const Mat& audio_samples, VideoClip* video_clip )
+double CombinedVideoClip::SynchronizeToReference ( const AudioCorrelator& correlator, const Mat& audio_samples, VideoClip* video_clip )
 {
-    int padding_size = audio_samples.cols;
-    Mat reference_audio_sample_with_padding, correlation;
-    copyMakeBorder ( reference_samples, reference_audio_sample_with_padding, 0, 0, padding_size, padding_size, cv::BORDER_CONSTANT, Scalar ( 0 ) );
-    matchTemplate ( reference_audio_sample_with_padding, audio_samples, correlation, cv::TM_CCORR );
-
-    double min_val, max_val;
-    Point min_pos, max_pos;
-    minMaxLoc ( correlation, &min_val, &max_val, &min_pos, &max_pos, Mat() );
-    video_clip->SetShiftInSeconds ( ( max_pos.x-padding_size ) / video_clip->GetAudioSampleRate() );
+    AudioAlignment alignment = correlator.Align ( audio_samples );
+    video_clip->SetShiftInSeconds ( alignment.lag / video_clip->GetAudioSampleRate() );
+    cout << "\tPeak to sidelobe ratio " << alignment.peak_to_sidelobe << ": " << video_clip->GetFileName() << endl;
+    if ( alignment.peak_to_sidelobe < kMinPeakToSidelobe )
+    {
+        cout << "\tWarning: audio correlation peak is weak, synchronization may be wrong." << endl;
+    }
 
     return video_clip->GetShiftInSeconds();
 }
@@ -0,0 +1,213 @@
+#include "demuxer.h"
+
+#include <algorithm>
+#include <mutex>
+
+Demuxer::~Demuxer()
+{
+    Close();
+}
+
+bool Demuxer::Open ( const string& file_name )
+{
+    Close();
+#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT ( 58, 9, 100 )
+    // Registering is needed once per process by versions before it was deprecated.
+    static once_flag register_flag;
+    call_once ( register_flag, [] { av_register_all(); } );
+#endif
+    if ( avformat_open_input ( &_format_context, file_name.c_str(), NULL, NULL ) != 0 )
+    {
+        cerr << "FFmpeg: Fail to open file " << file_name << endl;
+        return false;
+    }
+    if ( avformat_find_stream_info ( _format_context, NULL ) < 0 )
+    {
+        cerr << "FFmpeg: Cannot find stream information in the file " << file_name << endl;
+        Close();
+        return false;
+    }
+    _wanted_streams.assign ( _format_context->nb_streams, false );
+    _packet_queues.resize ( _format_context->nb_streams );
+    _missed_streams.assign ( _format_context->nb_streams, false );
+    _resume_times.assign ( _format_context->nb_streams, AV_NOPTS_VALUE );
+    _delivered_dts.assign ( _format_context->nb_streams, AV_NOPTS_VALUE );
+    return true;
+}
+
+void Demuxer::Close()
+{
+    for ( unsigned i=0; i<_packet_queues.size(); i++ )
+    {
+        DropQueue ( i );
+    }
+    _wanted_streams.clear();
+    _packet_queues.clear();
+    _missed_streams.clear();
+    _resume_times.clear();
+    _delivered_dts.clear();
+    avformat_close_input ( &_format_context );
+}
+
+int Demuxer::FindBestStream ( const AVMediaType media_type, AVCodec** codec ) const
+{
+    if ( !IsOpened() )
+    {
+        return -1;
+    }
+    return av_find_best_stream ( _format_context, media_type, -1, -1, codec, 0 );
+}
+
+void Demuxer::SetStreamWanted ( const int stream_index, const bool wanted )
+{
+    if ( !IsOpened() )
+    {
+        return;
+    }
+    _wanted_streams[stream_index] = wanted;
+    if ( !wanted )
+    {
+        DropQueue ( stream_index );
+    }
+}
+
+bool Demuxer::ReadPacket ( const int stream_index, AVPacket* packet )
+{
+    if ( !IsOpened() )
+    {
+        return false;
+    }
+    if ( _missed_streams[stream_index] && !Resume ( stream_index ) )
+    {
+        return false;
+    }
+    deque<AVPacket*>& packet_queue = _packet_queues[stream_index];
+    if ( !packet_queue.empty() )
+    {
+        AVPacket* queued_packet = packet_queue.front();
+        packet_queue.pop_front();
+        _queued_bytes -= queued_packet->size;
+        av_packet_move_ref ( packet, queued_packet );
+        av_packet_free ( &queued_packet );
+        Deliver ( packet );
+        return true;
+    }
+    while ( av_read_frame ( _format_context, packet ) >= 0 )
+    {
+        int packet_stream = packet->stream_index;
+        // Packets delivered before resuming are read again, and skipped.
+        int64_t delivered_dts = _delivered_dts[packet_stream];
+        if ( delivered_dts != AV_NOPTS_VALUE && packet->dts != AV_NOPTS_VALUE && packet->dts <= delivered_dts )
+        {
+            av_packet_unref ( packet );
+            continue;
+        }
+        if ( packet_stream == stream_index )
+        {
+            Deliver ( packet );
+            return true;
+        }
+        if ( !_wanted_streams[packet_stream] || _missed_streams[packet_stream] )
+        {
+            _missed_streams[packet_stream] = true;
+        }
+        else if ( _queued_bytes + packet->size > kMaxQueuedBytes )
+        {
+            cout << "\tDropping packets of stream " << packet_stream << " over queue budget, to be read again." << endl;
+            DropQueue ( packet_stream );
+        }
+        else
+        {
+            // Referencing copies data of packets not reference counted, which are only valid until the next read.
+            AVPacket* queued_packet = av_packet_alloc();
+            if ( queued_packet && av_packet_ref ( queued_packet, packet ) == 0 )
+            {
+                _packet_queues[packet_stream].push_back ( queued_packet );
+                _queued_bytes += queued_packet->size;
+            }
+            else
+            {
+                av_packet_free ( &queued_packet );
+                DropQueue ( packet_stream );
+            }
+        }
+        av_packet_unref ( packet );
+    }
+    return false;
+}
+
+bool Demuxer::Seek ( const int stream_index, const double seconds )
+{
+    if ( !IsOpened() )
+    {
+        return false;
+    }
+    AVStream* stream = _format_context->streams[stream_index];
+    int64_t start_time = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+    int64_t target = start_time + ( int64_t ) ( seconds / av_q2d ( stream->time_base ) );
+    if ( av_seek_frame ( _format_context, stream_index, target, AVSEEK_FLAG_BACKWARD ) < 0 )
+    {
+        return false;
+    }
+    // Other streams lose their place in file, and resume once read.
+    for ( unsigned i=0; i<_packet_queues.size(); i++ )
+    {
+        DropQueue ( i );
+        _missed_streams[i] = true;
+    }
+    _missed_streams[stream_index] = false;
+    _resume_times[stream_index] = av_rescale_q ( target, stream->time_base, AV_TIME_BASE_Q );
+    _delivered_dts[stream_index] = AV_NOPTS_VALUE;
+    return true;
+}
+
+void Demuxer::DropQueue ( const int stream_index )
+{
+    _missed_streams[stream_index] = true;
+    for ( AVPacket* queued_packet : _packet_queues[stream_index] )
+    {
+        _queued_bytes -= queued_packet->size;
+        av_packet_free ( &queued_packet );
+    }
+    _packet_queues[stream_index].clear();
+}
+
+bool Demuxer::Resume ( const int stream_index )
+{
+    int64_t target = _resume_times[stream_index];
+    for ( unsigned i=0; i<_resume_times.size(); i++ )
+    {
+        if ( _wanted_streams[i] && target != AV_NOPTS_VALUE )
+        {
+            target = _resume_times[i] == AV_NOPTS_VALUE ? AV_NOPTS_VALUE : min ( target, _resume_times[i] );
+        }
+    }
+    if ( target == AV_NOPTS_VALUE )
+    {
+        target = _format_context->start_time != AV_NOPTS_VALUE ? _format_context->start_time : 0;
+    }
+    if ( avformat_seek_file ( _format_context, -1, INT64_MIN, target, target, 0 ) < 0 )
+    {
+        return false;
+    }
+    for ( unsigned i=0; i<_packet_queues.size(); i++ )
+    {
+        DropQueue ( i );
+        _missed_streams[i] = false;
+    }
+    return true;
+}
+
+void Demuxer::Deliver ( const AVPacket* packet )
+{
+    AVStream* stream = _format_context->streams[packet->stream_index];
+    int64_t timestamp = packet->dts != AV_NOPTS_VALUE ? packet->dts : packet->pts;
+    if ( timestamp != AV_NOPTS_VALUE )
+    {
+        _resume_times[packet->stream_index] = av_rescale_q ( timestamp, stream->time_base, AV_TIME_BASE_Q );
+    }
+    if ( packet->dts != AV_NOPTS_VALUE )
+    {
+        _delivered_dts[packet->stream_index] = packet->dts;
+    }
+}
@@ -0,0 +1,130 @@
+#include "drift_tracker.h"
+#include "audio_correlator.h"
+
+#include <cstring>
+
+DriftTracker::DriftTracker ( AudioStream* reference_stream, const Mat& reference_samples, const double block_seconds,
+                             const double search_seconds )
+    : _sample_rate ( reference_stream->GetSampleRate() )
+{
+    CV_Assert ( _sample_rate > 0 && reference_samples.type() == CV_32FC1 && reference_samples.rows == 1 );
+    _reference.audio_stream = reference_stream;
+    _reference.samples.assign ( reference_samples.ptr<float>(), reference_samples.ptr<float>() + reference_samples.cols );
+    _block_size = max ( cvRound ( block_seconds * _sample_rate ), 1 );
+    _search_radius = max ( cvRound ( search_seconds * _sample_rate ), 1 );
+    _dft_size = getOptimalDFTSize ( _block_size + 2 * _search_radius );
+}
+
+void DriftTracker::AddClip ( AudioStream* audio_stream, const Mat& leading_samples, const int initial_lag )
+{
+    CV_Assert ( audio_stream->GetSampleRate() == _sample_rate && leading_samples.type() == CV_32FC1 && leading_samples.rows == 1 );
+    unique_ptr<ClipState> clip ( new ClipState() );
+    clip->buffer.audio_stream = audio_stream;
+    clip->buffer.samples.assign ( leading_samples.ptr<float>(), leading_samples.ptr<float>() + leading_samples.cols );
+    clip->lag = initial_lag;
+    _clips.push_back ( move ( clip ) );
+}
+
+void DriftTracker::Track()
+{
+    // Blocks are zero padded to DFT size, and only the last partial block of reference is left out.
+    Mat reference_block = Mat::zeros ( 1, _dft_size, CV_32FC1 );
+    Mat reference_spectrum;
+    for ( int64_t block_start=0; ; block_start += _block_size )
+    {
+        ReadSamples ( block_start, block_start + _block_size, &_reference, reference_block.ptr<float>() );
+        if ( _reference.first_sample + ( int64_t ) _reference.samples.size() < block_start + _block_size )
+        {
+            break;
+        }
+        dft ( reference_block, reference_spectrum );
+        bool tracking = false;
+        for ( unique_ptr<ClipState>& clip : _clips )
+        {
+            tracking = TrackBlock ( reference_spectrum, block_start, clip.get() ) || tracking;
+        }
+        if ( !tracking )
+        {
+            break;
+        }
+    }
+}
+
+bool DriftTracker::ReadSamples ( const int64_t begin, const int64_t end, SampleBuffer* buffer, float* destination )
+{
+    // Reads stream until buffer holds samples up to end.
+    while ( !buffer->finished && buffer->first_sample + ( int64_t ) buffer->samples.size() < end )
+    {
+        size_t sample_count = buffer->samples.size();
+        buffer->samples.resize ( sample_count + _block_size );
+        int read_count = buffer->audio_stream->Read ( buffer->samples.data() + sample_count, _block_size );
+        buffer->samples.resize ( sample_count + read_count );
+        buffer->finished = read_count < _block_size;
+    }
+    int64_t samples_end = buffer->first_sample + buffer->samples.size();
+    if ( buffer->finished && samples_end <= begin )
+    {
+        return false;
+    }
+    int64_t copy_begin = max ( begin, buffer->first_sample );
+    int64_t copy_end = min ( end, samples_end );
+    if ( copy_end > copy_begin )
+    {
+        memcpy ( destination + ( copy_begin - begin ), buffer->samples.data() + ( copy_begin - buffer->first_sample ),
+                 ( copy_end - copy_begin ) * sizeof ( float ) );
+    }
+    // Drops samples before begin, as reads of following blocks start later.
+    if ( begin > buffer->first_sample )
+    {
+        int64_t drop_count = min ( begin - buffer->first_sample, ( int64_t ) buffer->samples.size() );
+        buffer->samples.erase ( buffer->samples.begin(), buffer->samples.begin() + drop_count );
+        buffer->first_sample += drop_count;
+    }
+    return true;
+}
+
+bool DriftTracker::TrackBlock ( const Mat& reference_spectrum, const int64_t block_start, ClipState* clip )
+{
+    // Segment of clip covers the block at the last lag, widened by search radius on both sides.
+    int center = clip->lag;
+    int64_t segment_begin = block_start - center - _search_radius;
+    Mat segment = Mat::zeros ( 1, _dft_size, CV_32FC1 );
+    if ( !ReadSamples ( segment_begin, segment_begin + _block_size + 2 * _search_radius, &clip->buffer, segment.ptr<float>() ) )
+    {
+        return false;
+    }
+    Mat segment_spectrum, cross_spectrum, correlation;
+    dft ( segment, segment_spectrum );
+    mulSpectrums ( segment_spectrum, reference_spectrum, cross_spectrum, 0, true );
+    idft ( cross_spectrum, correlation, DFT_SCALE | DFT_REAL_OUTPUT );
+    // Correlation at offset d of segment is of lag center + search radius - d, so it is flipped for increasing lags.
+    Mat block_correlation;
+    flip ( correlation.colRange ( 0, 2 * _search_radius + 1 ), block_correlation, 1 );
+
+    // Sums correlations of this and the previous block over the lags both searched.
+    int lag_begin = max ( center, clip->block_center ) - _search_radius;
+    int lag_end = min ( center, clip->block_center ) + _search_radius + 1;
+    if ( !clip->block_correlation.empty() && lag_end > lag_begin )
+    {
+        Mat window_correlation = block_correlation.colRange ( lag_begin - center + _search_radius, lag_end - center + _search_radius )
+                                 + clip->block_correlation.colRange ( lag_begin - clip->block_center + _search_radius,
+                                         lag_end - clip->block_center + _search_radius );
+        Point peak_pos;
+        minMaxLoc ( window_correlation, NULL, NULL, NULL, &peak_pos );
+        int peak_half_width = max ( cvRound ( 0.002 * _sample_rate ), 1 );
+        double peak_to_sidelobe = AudioCorrelator::MeasurePeakToSidelobe ( window_correlation, peak_pos.x, peak_half_width );
+        // Window is centered at the start of this block. Lags jumping faster than any clock drifts are false peaks.
+        int lag = lag_begin + peak_pos.x;
+        double window_time = ( double ) block_start / _sample_rate;
+        double max_lag_change = kMaxDriftRate * ( window_time - clip->lag_time ) * _sample_rate + 2.0;
+        if ( peak_to_sidelobe >= kMinPeakToSidelobe && abs ( lag - clip->lag ) <= max_lag_change )
+        {
+            clip->lag = lag;
+            clip->lag_time = window_time;
+            clip->time_map.AddKnot ( window_time, ( double ) lag / _sample_rate );
+        }
+    }
+    clip->block_correlation = block_correlation;
+    clip->block_center = center;
+    return true;
+}
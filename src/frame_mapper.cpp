@@ -1,43 +1,627 @@
 #include "frame_mapper.h"
 
-FrameMapper::FrameMapper ( const Camera& camera, const Size& output_size, const int project_size )
-    :_camera ( camera ), _output_size ( output_size )
+namespace
+{
+template<typename T>
+void WriteValue ( ostream& stream, const T& value )
+{
+    stream.write ( reinterpret_cast<const char*> ( &value ), sizeof ( T ) );
+}
+
+template<typename T>
+void WriteArray ( ostream& stream, const vector<T>& values )
+{
+    WriteValue<uint64_t> ( stream, values.size() );
+    stream.write ( reinterpret_cast<const char*> ( values.data() ), values.size() * sizeof ( T ) );
+}
+
+template<typename T>
+bool ReadValue ( const uchar** data, const uchar* data_end, T* value )
+{
+    if ( data_end - *data < ( ptrdiff_t ) sizeof ( T ) )
+    {
+        return false;
+    }
+    memcpy ( value, *data, sizeof ( T ) );
+    *data += sizeof ( T );
+    return true;
+}
+
+template<typename T>
+bool ReadArray ( const uchar** data, const uchar* data_end, vector<T>* values )
+{
+    uint64_t size;
+    if ( !ReadValue ( data, data_end, &size ) || ( uint64_t ) ( data_end - *data ) / sizeof ( T ) < size )
+    {
+        return false;
+    }
+    values->resize ( size );
+    memcpy ( values->data(), *data, size * sizeof ( T ) );
+    *data += size * sizeof ( T );
+    return true;
+}
+
+// Returns whether entries of remap table are in increasing canvas order within canvas of canvas pixel count,
+// and their source pixels are on frame.
+bool IsValidRemapTable ( const RemapTable& table, const int canvas_pixel_count, const Size& frame_size )
+{
+    for ( int i=0; i<table.Size(); i++ )
+    {
+        int canvas_offset = table.canvas_offsets[i];
+        if ( canvas_offset < 0 || canvas_offset >= canvas_pixel_count || ( i > 0 && canvas_offset <= table.canvas_offsets[i-1] )
+                || table.frame_xs[i] < 0 || table.frame_xs[i] >= frame_size.width
+                || table.frame_ys[i] < 0 || table.frame_ys[i] >= frame_size.height )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+}
+
+FrameMapper::FrameMapper ( const Camera& camera, const Size& output_size, const int project_size,
+                           const WeightStorage weight_storage, const double mesh_tolerance,
+                           const OutputProjection& projection )
+    :_camera ( camera ), _frame_size ( camera.GetFrameSize() ), _output_size ( output_size ), _projection ( projection ),
+     _weight_storage ( weight_storage )
 {
     int width = output_size.width;
     int height = output_size.height;
-    _weight_mat = Mat::zeros ( height, width, CV_64FC1 );
-    for ( int i=0; i*project_size<width; i++ )
+    // Only visits meshes in camera's footprint, and keeps weights for the bounding box of them.
+    Mat footprint = ComputeFootprint ( camera, output_size, project_size, projection );
+    vector<Rect> face_rects = projection.GetFaceRects ( output_size );
+    vector<Point> footprint_meshes;
+    findNonZero ( footprint, footprint_meshes );
+    Rect mesh_roi = footprint_meshes.empty() ? Rect() : boundingRect ( footprint_meshes );
+    _weight_roi = Rect ( mesh_roi.x * project_size, mesh_roi.y * project_size,
+                         mesh_roi.width * project_size, mesh_roi.height * project_size ) & Rect ( 0, 0, width, height );
+    _weight_mat = Mat::zeros ( _weight_roi.size(), CV_64FC1 );
+    _max_mesh_error = 0.0;
+    _mesh_count = 0;
+    // Walks canvas band by band, so meshes, weight mat and remap table are all filled in row-major order.
+    for ( int j=mesh_roi.y; j<mesh_roi.y+mesh_roi.height; j++ )
     {
-        for ( int j=0; j*project_size<height; j++ )
+        vector<Mesh> band_meshes;
+        const uchar* footprint_row = footprint.ptr<uchar> ( j );
+        int band_begin = j * project_size;
+        int band_end = min ( ( j+1 ) * project_size, height );
+        for ( int i=mesh_roi.x; i<mesh_roi.x+mesh_roi.width; i++ )
+        {
+            if ( footprint_row[i] == 0 )
+            {
+                continue;
+            }
+            // Clips mesh to projection faces, so no mesh interpolates across a face border.
+            Rect mesh_rect ( Point ( i * project_size, band_begin ), Point ( min ( ( i+1 ) * project_size, width ), band_end ) );
+            vector<Mesh> pending_meshes;
+            for ( const Rect& face_rect : face_rects )
+            {
+                Rect face_mesh_rect = mesh_rect & face_rect;
+                if ( face_mesh_rect.area() > 0 )
+                {
+                    pending_meshes.push_back ( Mesh ( face_mesh_rect.x, face_mesh_rect.y, face_mesh_rect.br().x - 1,
+                                                      face_mesh_rect.br().y - 1, output_size, projection, camera ) );
+                }
+            }
+            // Splits mesh until its interpolation error is within tolerance, or it reaches minimum size.
+            while ( !pending_meshes.empty() )
+            {
+                Mesh mesh = pending_meshes.back();
+                pending_meshes.pop_back();
+                double error = mesh_tolerance > 0.0 ? mesh.MeasureInterpolationError ( output_size, projection, camera ) : 0.0;
+                if ( error > mesh_tolerance && mesh.CanSplit ( _min_mesh_size ) )
+                {
+                    vector<Mesh> split_meshes = mesh.Split ( _min_mesh_size, output_size, projection, camera );
+                    pending_meshes.insert ( pending_meshes.end(), split_meshes.begin(), split_meshes.end() );
+                    continue;
+                }
+                mesh.ComputeWeights ( camera, &_weight_mat, _weight_roi.tl() );
+                if ( mesh.CheckValidity(camera) )
+                {
+                    band_meshes.push_back ( mesh );
+                    // Meshes crossing the horizon of camera can't be interpolated at all, and are left out of the error.
+                    if ( error != numeric_limits<double>().infinity() )
+                    {
+                        _max_mesh_error = max ( _max_mesh_error, error );
+                    }
+                }
+            }
+        }
+        _mesh_count += band_meshes.size();
+        // Meshes covering a canvas row are visited from left to right.
+        stable_sort ( band_meshes.begin(), band_meshes.end(), [] ( const Mesh& a, const Mesh& b )
+        {
+            return a.GetLeft() < b.GetLeft();
+        } );
+        for ( int p_y=band_begin; p_y<band_end; p_y++ )
         {
-            Mesh mesh = Mesh ( j, i, project_size, output_size, camera, &_weight_mat );
-            if ( mesh.CheckValidity(camera) )
+            for ( const Mesh& mesh : band_meshes )
             {
-                _mesh_vector.push_back ( mesh );
+                mesh.AppendRemapEntries ( p_y, output_size, camera.GetFrameSize(), &_copy_sources );
             }
         }
     }
+    // Every mapped pixel is copied until weights are normalized.
+    BuildSpans ( _copy_sources, &_copy_spans, &_copy_span_row_begins );
+    BuildSpans ( _blend_sources, &_blend_spans, &_blend_span_row_begins );
 }
 
-void FrameMapper::PaintOnCanvas ( const Mat& frame, Mat* canvas )
+void FrameMapper::PaintOnCanvas ( const Mat& frame, Mat* canvas ) const
 {
-    // Paints each mesh.
-    for ( unsigned i=0; i<_mesh_vector.size(); i++ )
+    PaintOnCanvas ( frame, canvas, 0, _output_size.height );
+}
+
+void FrameMapper::PaintOnCanvas ( const Mat& frame, Mat* canvas, const int row_begin, const int row_end ) const
+{
+    CV_Assert ( ( frame.type() == CV_8UC3 || frame.type() == CV_8UC1 ) && frame.size() == _frame_size );
+    CV_Assert ( canvas->type() == frame.type() && canvas->size() == _output_size && canvas->isContinuous() );
+    CV_Assert ( 0 <= row_begin && row_begin <= row_end && row_end <= _output_size.height );
+    if ( frame.channels() == 3 )
     {
-        Mesh* mesh = &_mesh_vector[i];
-        mesh->Paint ( canvas, frame, _weight_mat );
+        PaintPixels<3> ( frame, canvas, row_begin, row_end );
+    }
+    else
+    {
+        PaintPixels<1> ( frame, canvas, row_begin, row_end );
     }
 }
 
+template<int channels>
+void FrameMapper::PaintPixels ( const Mat& frame, Mat* canvas, const int row_begin, const int row_end ) const
+{
+    // Gathers source pixels of each copied run straight into consecutive canvas pixels.
+    uchar* canvas_data = canvas->ptr<uchar> ();
+    for ( int i=_copy_span_row_begins[row_begin]; i<_copy_span_row_begins[row_end]; i++ )
+    {
+        const RemapSpan& span = _copy_spans[i];
+        uchar* target = canvas_data + channels * span.canvas_offset;
+        const short* source_xs = &_copy_sources.frame_xs[span.first_index];
+        const short* source_ys = &_copy_sources.frame_ys[span.first_index];
+        for ( int k=0; k<span.pixel_count; k++ )
+        {
+            const uchar* source = frame.ptr<uchar> ( source_ys[k] ) + channels * source_xs[k];
+            for ( int c=0; c<channels; c++ )
+            {
+                target[channels * k + c] = source[c];
+            }
+        }
+    }
+    // Gathers source pixels of each blended run in chunks, then accumulates them on canvas at once.
+    // Weights are kept one per channel of BGR pixels, so single plane runs gather every third one.
+    const int chunk_size = 256;
+    uchar gathered[channels * chunk_size];
+    ushort gathered_weights[chunk_size];
+    for ( int i=_blend_span_row_begins[row_begin]; i<_blend_span_row_begins[row_end]; i++ )
+    {
+        const RemapSpan& span = _blend_spans[i];
+        for ( int start=0; start<span.pixel_count; start+=chunk_size )
+        {
+            int count = min ( chunk_size, span.pixel_count - start );
+            const short* source_xs = &_blend_sources.frame_xs[span.first_index + start];
+            const short* source_ys = &_blend_sources.frame_ys[span.first_index + start];
+            for ( int k=0; k<count; k++ )
+            {
+                const uchar* source = frame.ptr<uchar> ( source_ys[k] ) + channels * source_xs[k];
+                for ( int c=0; c<channels; c++ )
+                {
+                    gathered[channels * k + c] = source[c];
+                }
+            }
+            const ushort* weights = &_blend_weights[3 * ( span.first_index + start )];
+            if ( channels != 3 )
+            {
+                for ( int k=0; k<count; k++ )
+                {
+                    gathered_weights[k] = weights[3 * k];
+                }
+                weights = gathered_weights;
+            }
+            BlendKernel::AccumulateRow ( gathered, weights, canvas_data + channels * ( span.canvas_offset + start ), channels * count );
+        }
+    }
+}
+
+FrameMapper FrameMapper::GetChromaMapper() const
+{
+    FrameMapper chroma_mapper;
+    chroma_mapper._camera = _camera;
+    chroma_mapper._frame_size = Size ( ( _frame_size.width + 1 ) / 2, ( _frame_size.height + 1 ) / 2 );
+    chroma_mapper._output_size = Size ( ( _output_size.width + 1 ) / 2, ( _output_size.height + 1 ) / 2 );
+    chroma_mapper._projection = _projection;
+    chroma_mapper._weight_storage = _weight_storage;
+    chroma_mapper._blending_weight_th = _blending_weight_th;
+    chroma_mapper._max_mesh_error = _max_mesh_error;
+    chroma_mapper._mesh_count = _mesh_count;
+    // Each chroma pixel takes the mapping of the top-left luma pixel it covers, halved.
+    int chroma_width = chroma_mapper._output_size.width;
+    for ( int i=0; i<_copy_sources.Size(); i++ )
+    {
+        int canvas_offset = _copy_sources.canvas_offsets[i];
+        int p_x = canvas_offset % _output_size.width;
+        int p_y = canvas_offset / _output_size.width;
+        if ( p_x % 2 == 0 && p_y % 2 == 0 )
+        {
+            chroma_mapper._copy_sources.Append ( p_y / 2 * chroma_width + p_x / 2, _copy_sources.frame_xs[i] / 2, _copy_sources.frame_ys[i] / 2 );
+        }
+    }
+    for ( int i=0; i<_blend_sources.Size(); i++ )
+    {
+        int canvas_offset = _blend_sources.canvas_offsets[i];
+        int p_x = canvas_offset % _output_size.width;
+        int p_y = canvas_offset / _output_size.width;
+        if ( p_x % 2 == 0 && p_y % 2 == 0 )
+        {
+            chroma_mapper._blend_sources.Append ( p_y / 2 * chroma_width + p_x / 2, _blend_sources.frame_xs[i] / 2, _blend_sources.frame_ys[i] / 2 );
+            chroma_mapper._blend_weights.insert ( chroma_mapper._blend_weights.end(), &_blend_weights[3 * i], &_blend_weights[3 * i] + 3 );
+        }
+    }
+    chroma_mapper.BuildSpans ( chroma_mapper._copy_sources, &chroma_mapper._copy_spans, &chroma_mapper._copy_span_row_begins );
+    chroma_mapper.BuildSpans ( chroma_mapper._blend_sources, &chroma_mapper._blend_spans, &chroma_mapper._blend_span_row_begins );
+    return chroma_mapper;
+}
+
 void FrameMapper::NormalizeWeight ( Mat total_weight )
 {
-    Mat normalized_weight_mat = Mat::zeros ( total_weight.rows, total_weight.cols, total_weight.type() );
-    divide ( _weight_mat, total_weight, normalized_weight_mat );
+    Mat normalized_weight_mat = Mat::zeros ( _weight_roi.size(), CV_64FC1 );
+    if ( _weight_roi.area() > 0 )
+    {
+        divide ( _weight_mat, total_weight ( _weight_roi ), normalized_weight_mat );
+    }
 
     normalized_weight_mat.copyTo ( _weight_mat );
+
+    // Splits entries into directly copied pixels and blended pixels,
+    // and drops entries which contribute nothing to canvas.
+    const double* weight_data = _weight_mat.ptr<double> ();
+    RemapTable copied_table;
+    copied_table.Reserve ( _copy_sources.Size() );
+    _blend_sources.Clear();
+    _blend_weights.clear();
+    for ( int i=0; i<_copy_sources.Size(); i++ )
+    {
+        int canvas_offset = _copy_sources.canvas_offsets[i];
+        short frame_x = _copy_sources.frame_xs[i];
+        short frame_y = _copy_sources.frame_ys[i];
+        int weight_x = canvas_offset % _output_size.width - _weight_roi.x;
+        int weight_y = canvas_offset / _output_size.width - _weight_roi.y;
+        double weight = weight_data[weight_y * _weight_roi.width + weight_x];
+        if ( weight > 0.5+_blending_weight_th )
+        {
+            copied_table.Append ( canvas_offset, frame_x, frame_y );
+            continue;
+        }
+        if ( weight <= 0.5-_blending_weight_th )
+        {
+            continue;
+        }
+        ushort blend_weight = BlendKernel::QuantizeWeight ( ( weight-0.5+_blending_weight_th ) / ( 2*_blending_weight_th ) );
+        if ( blend_weight == 0 )
+        {
+            continue;
+        }
+        _blend_sources.Append ( canvas_offset, frame_x, frame_y );
+        _blend_weights.insert ( _blend_weights.end(), 3, blend_weight );
+    }
+    swap ( _copy_sources, copied_table );
+    BuildSpans ( _copy_sources, &_copy_spans, &_copy_span_row_begins );
+    BuildSpans ( _blend_sources, &_blend_spans, &_blend_span_row_begins );
+
+    // Keeps normalized weights as fixed point if required.
+    if ( _weight_storage == WEIGHT_STORAGE_FIXED_16 )
+    {
+        _weight_scale = numeric_limits<ushort>::max();
+        Mat quantized_weight_mat;
+        _weight_mat.convertTo ( quantized_weight_mat, CV_16UC1, _weight_scale );
+        _weight_mat = quantized_weight_mat;
+    }
+    else if ( _weight_storage == WEIGHT_STORAGE_FIXED_8 )
+    {
+        _weight_scale = numeric_limits<uchar>::max();
+        Mat quantized_weight_mat;
+        _weight_mat.convertTo ( quantized_weight_mat, CV_8UC1, _weight_scale );
+        _weight_mat = quantized_weight_mat;
+    }
+}
+
+Mat FrameMapper::ComputeFootprint ( const Camera& camera, const Size& output_size, const int project_size,
+                                     const OutputProjection& projection )
+{
+    if ( projection.GetType() != PROJECTION_EQUIRECTANGULAR )
+    {
+        return SampleFootprint ( camera, output_size, project_size, projection );
+    }
+    int grid_cols = ( output_size.width + project_size - 1 ) / project_size;
+    int grid_rows = ( output_size.height + project_size - 1 ) / project_size;
+    Size frame_size = camera.GetFrameSize();
+
+    // Traces frame border clockwise, one sample per frame pixel.
+    vector<Point2d> frame_border;
+    for ( int x=0; x<frame_size.width; x++ )
+    {
+        frame_border.push_back ( Point2d ( x, 0 ) );
+    }
+    for ( int y=0; y<frame_size.height; y++ )
+    {
+        frame_border.push_back ( Point2d ( frame_size.width - 1, y ) );
+    }
+    for ( int x=frame_size.width-1; x>=0; x-- )
+    {
+        frame_border.push_back ( Point2d ( x, frame_size.height - 1 ) );
+    }
+    for ( int y=frame_size.height-1; y>=0; y-- )
+    {
+        frame_border.push_back ( Point2d ( 0, y ) );
+    }
+
+    // Projects border to meshes on canvas, unwrapping it across the azimuth seam.
+    Mat border = Mat::zeros ( grid_rows, grid_cols, CV_8UC1 );
+    vector<Point> polygon;
+    double shift = 0.0;
+    double last_x = 0.0;
+    for ( const Point2d& frame_pt : frame_border )
+    {
+        Point2d screen_pt = Utils::GetScreenPointFromSpherePoint ( camera.ProjectFrameToWorld ( frame_pt ), output_size );
+        double x = screen_pt.x + shift;
+        if ( !polygon.empty() && x - last_x > output_size.width / 2.0 )
+        {
+            shift -= output_size.width;
+            x -= output_size.width;
+        }
+        else if ( !polygon.empty() && x - last_x < -output_size.width / 2.0 )
+        {
+            shift += output_size.width;
+            x += output_size.width;
+        }
+        last_x = x;
+        Point grid_pt ( cvFloor ( x / project_size ), min ( cvFloor ( screen_pt.y / project_size ), grid_rows - 1 ) );
+        border.at<uchar> ( grid_pt.y, ( grid_pt.x % grid_cols + grid_cols ) % grid_cols ) = 255;
+        if ( polygon.empty() || polygon.back() != grid_pt )
+        {
+            polygon.push_back ( grid_pt );
+        }
+    }
+
+    // A border going once around the azimuth encloses a pole, so the polygon is closed through the top row.
+    if ( fabs ( shift ) > output_size.width / 2.0 )
+    {
+        polygon.push_back ( Point ( polygon.back().x, -1 ) );
+        polygon.push_back ( Point ( polygon.front().x, -1 ) );
+    }
+    // Fills polygon with copies shifted by whole turns of azimuth, so every part lands on canvas.
+    Mat footprint = Mat::zeros ( grid_rows, grid_cols, CV_8UC1 );
+    vector<vector<Point>> polygons ( 1, polygon );
+    for ( int turn=-2; turn<=2; turn++ )
+    {
+        fillPoly ( footprint, polygons, Scalar ( 255 ), 8, 0, Point ( turn * grid_cols, 0 ) );
+    }
+    // Border splits sphere into two parts, keeps the part containing camera center.
+    Point2d center_pt = Utils::GetScreenPointFromSpherePoint ( camera.ProjectFrameToWorld ( camera.GetCameraCenter() ), output_size );
+    int center_col = min ( cvFloor ( center_pt.x / project_size ), grid_cols - 1 );
+    int center_row = min ( cvFloor ( center_pt.y / project_size ), grid_rows - 1 );
+    if ( footprint.at<uchar> ( center_row, center_col ) == 0 )
+    {
+        bitwise_not ( footprint, footprint );
+    }
+    footprint |= border;
+
+    // Grows footprint by one mesh to cover meshes partially inside, wrapping around the azimuth seam.
+    Mat wrapped_footprint;
+    copyMakeBorder ( footprint, wrapped_footprint, 0, 0, 1, 1, BORDER_WRAP );
+    dilate ( wrapped_footprint, wrapped_footprint, Mat::ones ( 3, 3, CV_8UC1 ) );
+    return wrapped_footprint.colRange ( 1, grid_cols + 1 ).clone();
+}
+
+Mat FrameMapper::SampleFootprint ( const Camera& camera, const Size& output_size, const int project_size,
+                                    const OutputProjection& projection )
+{
+    int grid_cols = ( output_size.width + project_size - 1 ) / project_size;
+    int grid_rows = ( output_size.height + project_size - 1 ) / project_size;
+    Size frame_size = camera.GetFrameSize();
+
+    // Projects corners and center of every mesh to frame at once, corners shared by neighbors once.
+    vector<double> sphere_pts;
+    for ( int j=0; j<=2*grid_rows; j++ )
+    {
+        for ( int i=0; i<=2*grid_cols; i++ )
+        {
+            Point2d screen_pt ( min ( i * project_size / 2, output_size.width - 1 ), min ( j * project_size / 2, output_size.height - 1 ) );
+            Point3d sphere_pt = projection.GetSpherePoint ( screen_pt, output_size );
+            sphere_pts.push_back ( sphere_pt.x );
+            sphere_pts.push_back ( sphere_pt.y );
+            sphere_pts.push_back ( sphere_pt.z );
+        }
+    }
+    vector<double> frame_pts ( sphere_pts.size() / 3 * 2 );
+    camera.ProjectWorldToFrame ( sphere_pts.data(), sphere_pts.size() / 3, frame_pts.data() );
+
+    // Marks meshes with any sample landing on frame.
+    Mat footprint = Mat::zeros ( grid_rows, grid_cols, CV_8UC1 );
+    for ( int j=0; j<=2*grid_rows; j++ )
+    {
+        for ( int i=0; i<=2*grid_cols; i++ )
+        {
+            const double* frame_pt = &frame_pts[2 * ( j * ( 2*grid_cols + 1 ) + i )];
+            if ( frame_pt[0] < 0 || frame_pt[1] < 0 || frame_pt[0] >= frame_size.width || frame_pt[1] >= frame_size.height )
+            {
+                continue;
+            }
+            for ( int row=max ( ( j-1 ) / 2, 0 ); row<=min ( j / 2, grid_rows - 1 ); row++ )
+            {
+                for ( int col=max ( ( i-1 ) / 2, 0 ); col<=min ( i / 2, grid_cols - 1 ); col++ )
+                {
+                    footprint.at<uchar> ( row, col ) = 255;
+                }
+            }
+        }
+    }
+
+    // Grows footprint by one mesh to cover meshes whose samples all miss a small part of frame.
+    dilate ( footprint, footprint, Mat::ones ( 3, 3, CV_8UC1 ) );
+    return footprint;
+}
+
+void FrameMapper::Write ( ostream& stream ) const
+{
+    WriteValue<int32_t> ( stream, _output_size.width );
+    WriteValue<int32_t> ( stream, _output_size.height );
+    WriteValue<int32_t> ( stream, _projection.GetType() );
+    WriteValue<int32_t> ( stream, _weight_storage );
+    WriteValue<double> ( stream, _weight_scale );
+    WriteValue<double> ( stream, _blending_weight_th );
+    WriteValue<double> ( stream, _max_mesh_error );
+    WriteValue<int32_t> ( stream, _mesh_count );
+    WriteValue<int32_t> ( stream, _weight_roi.x );
+    WriteValue<int32_t> ( stream, _weight_roi.y );
+    WriteValue<int32_t> ( stream, _weight_roi.width );
+    WriteValue<int32_t> ( stream, _weight_roi.height );
+    WriteValue<int32_t> ( stream, _weight_mat.type() );
+    Mat weight_mat = _weight_mat.isContinuous() ? _weight_mat : _weight_mat.clone();
+    stream.write ( reinterpret_cast<const char*> ( weight_mat.data ), weight_mat.total() * weight_mat.elemSize() );
+    WriteArray ( stream, _copy_sources.canvas_offsets );
+    WriteArray ( stream, _copy_sources.frame_xs );
+    WriteArray ( stream, _copy_sources.frame_ys );
+    WriteArray ( stream, _blend_sources.canvas_offsets );
+    WriteArray ( stream, _blend_sources.frame_xs );
+    WriteArray ( stream, _blend_sources.frame_ys );
+    WriteArray ( stream, _blend_weights );
+}
+
+bool FrameMapper::Read ( const Camera& camera, const uchar** data, const uchar* data_end )
+{
+    int32_t width, height, projection_type, weight_storage, roi_x, roi_y, roi_width, roi_height, weight_type;
+    if ( !ReadValue ( data, data_end, &width ) || !ReadValue ( data, data_end, &height )
+            || !ReadValue ( data, data_end, &projection_type ) || !ReadValue ( data, data_end, &weight_storage ) || !ReadValue ( data, data_end, &_weight_scale )
+            || !ReadValue ( data, data_end, &_blending_weight_th )
+            || !ReadValue ( data, data_end, &_max_mesh_error ) || !ReadValue ( data, data_end, &_mesh_count )
+            || !ReadValue ( data, data_end, &roi_x ) || !ReadValue ( data, data_end, &roi_y )
+            || !ReadValue ( data, data_end, &roi_width ) || !ReadValue ( data, data_end, &roi_height )
+            || !ReadValue ( data, data_end, &weight_type ) )
+    {
+        return false;
+    }
+    // Every size, index and enum is checked before use, so a corrupt file is rejected instead of painting out of bounds.
+    if ( width <= 0 || height <= 0 || ( int64_t ) width * height > numeric_limits<int>::max()
+            || projection_type < PROJECTION_EQUIRECTANGULAR || projection_type > PROJECTION_EQUIANGULAR_CUBEMAP )
+    {
+        return false;
+    }
+    int expected_weight_type = CV_64FC1;
+    double expected_weight_scale = 1.0;
+    switch ( weight_storage )
+    {
+    case WEIGHT_STORAGE_DOUBLE:
+        break;
+    case WEIGHT_STORAGE_FIXED_16:
+        expected_weight_type = CV_16UC1;
+        expected_weight_scale = numeric_limits<ushort>::max();
+        break;
+    case WEIGHT_STORAGE_FIXED_8:
+        expected_weight_type = CV_8UC1;
+        expected_weight_scale = numeric_limits<uchar>::max();
+        break;
+    default:
+        return false;
+    }
+    _camera = camera;
+    _frame_size = camera.GetFrameSize();
+    _output_size = Size ( width, height );
+    _projection = OutputProjection ( ( ProjectionType ) projection_type );
+    _weight_storage = ( WeightStorage ) weight_storage;
+    _weight_roi = Rect ( roi_x, roi_y, roi_width, roi_height );
+    if ( roi_width < 0 || roi_height < 0 || _weight_roi != ( _weight_roi & Rect ( 0, 0, width, height ) )
+            || weight_type != expected_weight_type || _weight_scale != expected_weight_scale || _mesh_count < 0 )
+    {
+        return false;
+    }
+    Mat weight_mat ( _weight_roi.size(), weight_type );
+    size_t weight_bytes = weight_mat.total() * weight_mat.elemSize();
+    if ( ( size_t ) ( data_end - *data ) < weight_bytes )
+    {
+        return false;
+    }
+    memcpy ( weight_mat.data, *data, weight_bytes );
+    *data += weight_bytes;
+    _weight_mat = weight_mat;
+    if ( !ReadArray ( data, data_end, &_copy_sources.canvas_offsets ) || !ReadArray ( data, data_end, &_copy_sources.frame_xs )
+            || !ReadArray ( data, data_end, &_copy_sources.frame_ys )
+            || !ReadArray ( data, data_end, &_blend_sources.canvas_offsets ) || !ReadArray ( data, data_end, &_blend_sources.frame_xs )
+            || !ReadArray ( data, data_end, &_blend_sources.frame_ys ) || !ReadArray ( data, data_end, &_blend_weights ) )
+    {
+        return false;
+    }
+    if ( _copy_sources.frame_xs.size() != _copy_sources.canvas_offsets.size() || _copy_sources.frame_ys.size() != _copy_sources.canvas_offsets.size()
+            || _blend_sources.frame_xs.size() != _blend_sources.canvas_offsets.size() || _blend_sources.frame_ys.size() != _blend_sources.canvas_offsets.size()
+            || _blend_weights.size() != 3 * _blend_sources.canvas_offsets.size() )
+    {
+        return false;
+    }
+    if ( !IsValidRemapTable ( _copy_sources, width * height, _frame_size ) || !IsValidRemapTable ( _blend_sources, width * height, _frame_size ) )
+    {
+        return false;
+    }
+    for ( ushort blend_weight : _blend_weights )
+    {
+        if ( blend_weight > 1 << BlendKernel::kWeightBits )
+        {
+            return false;
+        }
+    }
+    BuildSpans ( _copy_sources, &_copy_spans, &_copy_span_row_begins );
+    BuildSpans ( _blend_sources, &_blend_spans, &_blend_span_row_begins );
+    return true;
+}
+
+void FrameMapper::BuildSpans ( const RemapTable& sources, vector<RemapSpan>* spans, vector<int>* span_row_begins ) const
+{
+    // Extends last run if current pixel follows it in the same canvas row, otherwise starts a new run.
+    spans->clear();
+    for ( int i=0; i<sources.Size(); i++ )
+    {
+        int canvas_offset = sources.canvas_offsets[i];
+        if ( spans->empty() || spans->back().canvas_offset + spans->back().pixel_count != canvas_offset
+                || canvas_offset % _output_size.width == 0 )
+        {
+            RemapSpan span;
+            span.canvas_offset = canvas_offset;
+            span.pixel_count = 0;
+            span.first_index = i;
+            spans->push_back ( span );
+        }
+        spans->back().pixel_count++;
+    }
+    span_row_begins->assign ( _output_size.height + 1, 0 );
+    int index = 0;
+    for ( int p_y=0; p_y<=_output_size.height; p_y++ )
+    {
+        while ( index < ( int ) spans->size() && ( *spans ) [index].canvas_offset < p_y * _output_size.width )
+        {
+            index++;
+        }
+        ( *span_row_begins ) [p_y] = index;
+    }
 }
 
 Mat FrameMapper::GetWeightMat()
 {
     return _weight_mat;
 }
+
+Mat FrameMapper::GetNormalizedWeightMat()
+{
+    Mat normalized_weight_mat;
+    _weight_mat.convertTo ( normalized_weight_mat, CV_64FC1, 1.0 / _weight_scale );
+    return normalized_weight_mat;
+}
+
+double FrameMapper::GetMaxQuantizationError ( const WeightStorage weight_storage )
+{
+    switch ( weight_storage )
+    {
+    case WEIGHT_STORAGE_FIXED_16:
+        return 0.5 / numeric_limits<ushort>::max();
+    case WEIGHT_STORAGE_FIXED_8:
+        return 0.5 / numeric_limits<uchar>::max();
+    default:
+        return 0.0;
+    }
+}
@@ -0,0 +1,43 @@
+#include "frame_pool.h"
+
+FramePool::FramePool ( const int capacity, const Size& size, const int type )
+    : _size ( size ), _type ( type )
+{
+    CV_Assert ( capacity > 0 );
+    for ( int i=0; i<capacity; i++ )
+    {
+        _buffers.push_back ( Mat ( size, type ) );
+    }
+    _free_buffers = _buffers;
+}
+
+Mat FramePool::Lease()
+{
+    unique_lock<mutex> lock ( _pool_mutex );
+    _returned_condition.wait ( lock, [this] { return !_free_buffers.empty(); } );
+    Mat buffer = _free_buffers.back();
+    _free_buffers.pop_back();
+    return buffer;
+}
+
+void FramePool::Return ( const Mat& buffer )
+{
+    if ( buffer.empty() )
+    {
+        return;
+    }
+    // Only whole buffers of this pool come back, not reallocated or partial mats.
+    CV_Assert ( buffer.size() == _size && buffer.type() == _type );
+    bool from_pool = false;
+    for ( const Mat& pool_buffer : _buffers )
+    {
+        from_pool = from_pool || pool_buffer.data == buffer.data;
+    }
+    CV_Assert ( from_pool );
+    {
+        lock_guard<mutex> lock ( _pool_mutex );
+        CV_Assert ( _free_buffers.size() < _buffers.size() );
+        _free_buffers.push_back ( buffer );
+    }
+    _returned_condition.notify_one();
+}
@@ -1,44 +1,163 @@
 #include "mesh.h"
 
-Mesh::Mesh ( const int row_index, const int col_index, const int mesh_size,
-             const Size& canvas_size, const Camera& camera, Mat* weight_mat )
+Mesh::Mesh ( const int x_1, const int y_1, const int x_2, const int y_2, const Size& canvas_size,
+            const OutputProjection& projection, const Camera& camera )
+    : _x_1 ( x_1 ), _x_2 ( x_2 ), _y_1 ( y_1 ), _y_2 ( y_2 )
 {
-    int frame_width = camera.GetFrameSize().width;
-    int frame_height = camera.GetFrameSize().height;
-
-    _y_1= row_index * mesh_size;
-    _x_1 = col_index * mesh_size;
-    _y_2 = min ( _y_1 + mesh_size, canvas_size.height ) - 1;
-    _x_2 = min ( _x_1 + mesh_size, canvas_size.width ) - 1;
     // Calculates corners in canvas.
-    vector<Point2d> canvas_corners;
-    canvas_corners.push_back ( Point2d ( _x_1, _y_1 ) );
-    canvas_corners.push_back ( Point2d ( _x_2, _y_1 ) );
-    canvas_corners.push_back ( Point2d ( _x_1, _y_2 ) );
-    canvas_corners.push_back ( Point2d ( _x_2, _y_2 ) );
+    const Point2d canvas_corners[4] = { Point2d ( _x_1, _y_1 ), Point2d ( _x_2, _y_1 ), Point2d ( _x_1, _y_2 ), Point2d ( _x_2, _y_2 ) };
     // Calculates corners in sphere shaped screen.
-    vector<Point3d> sphere_corners;
-    sphere_corners.push_back ( Utils::GetSpherePointFromScreenPoint ( canvas_corners[0], canvas_size, 10.0 ) );
-    sphere_corners.push_back ( Utils::GetSpherePointFromScreenPoint ( canvas_corners[1], canvas_size, 10.0 ) );
-    sphere_corners.push_back ( Utils::GetSpherePointFromScreenPoint ( canvas_corners[2], canvas_size, 10.0 ) );
-    sphere_corners.push_back ( Utils::GetSpherePointFromScreenPoint ( canvas_corners[3], canvas_size, 10.0 ) );
-    // Calculates corners in camera coordinates system.
-    Mat sphere_corners_mat_n_3 = Mat ( sphere_corners ).reshape ( 1, sphere_corners.size() );
-    Mat frame_corners_mat_n_2 = camera.ProjectWorldToFrame ( sphere_corners_mat_n_3, false );
-    _pt_a = Point2d ( frame_corners_mat_n_2.at<double> ( 0, 0 ), frame_corners_mat_n_2.at<double> ( 0, 1 ) );
-    _pt_b = Point2d ( frame_corners_mat_n_2.at<double> ( 1, 0 ), frame_corners_mat_n_2.at<double> ( 1, 1 ) );
-    _pt_c = Point2d ( frame_corners_mat_n_2.at<double> ( 2, 0 ), frame_corners_mat_n_2.at<double> ( 2, 1 ) );
-    _pt_d = Point2d ( frame_corners_mat_n_2.at<double> ( 3, 0 ), frame_corners_mat_n_2.at<double> ( 3, 1 ) );
+    double sphere_corners[4][3];
+    for ( int k=0; k<4; k++ )
+    {
+        Point3d sphere_corner = projection.GetSpherePoint ( canvas_corners[k], canvas_size );
+        sphere_corners[k][0] = sphere_corner.x;
+        sphere_corners[k][1] = sphere_corner.y;
+        sphere_corners[k][2] = sphere_corner.z;
+    }
+    // Projects corners to frame at once.
+    double frame_corners[4][2];
+    camera.ProjectWorldToFrame ( sphere_corners[0], 4, frame_corners[0] );
+    _pt_a = Point2d ( frame_corners[0][0], frame_corners[0][1] );
+    _pt_b = Point2d ( frame_corners[1][0], frame_corners[1][1] );
+    _pt_c = Point2d ( frame_corners[2][0], frame_corners[2][1] );
+    _pt_d = Point2d ( frame_corners[3][0], frame_corners[3][1] );
+}
+
+bool Mesh::CheckValidity ( const Camera& camera )
+{
+    Size frameSize = camera.GetFrameSize();
+    int width = frameSize.width;
+    int height = frameSize.height;
+    // Corners alone miss meshes crossing a frame side between them, so every pixel on mesh sides is tested.
+    for ( int p_x=_x_1; p_x<=_x_2; p_x++ )
+    {
+        if ( !IsOutOfBound ( Interpolate ( p_x, _y_1 ), width, height ) || !IsOutOfBound ( Interpolate ( p_x, _y_2 ), width, height ) )
+        {
+            return true;
+        }
+    }
+    for ( int p_y=_y_1; p_y<=_y_2; p_y++ )
+    {
+        if ( !IsOutOfBound ( Interpolate ( _x_1, p_y ), width, height ) || !IsOutOfBound ( Interpolate ( _x_2, p_y ), width, height ) )
+        {
+            return true;
+        }
+    }
+    // No side lands on frame, so frame is either wholly outside the quadrilateral or wholly inside it.
+    const double invalid = numeric_limits<double>().max();
+    if ( _pt_a.x == invalid || _pt_b.x == invalid || _pt_c.x == invalid || _pt_d.x == invalid )
+    {
+        return false;
+    }
+    vector<Point2f> quadrilateral = { _pt_a, _pt_b, _pt_d, _pt_c };
+    return pointPolygonTest ( quadrilateral, Point2f ( 0.0f, 0.0f ), false ) >= 0;
+}
+
+double Mesh::MeasureInterpolationError ( const Size& canvas_size, const OutputProjection& projection, const Camera& camera ) const
+{
+    // Corners behind camera can't be interpolated, so meshes crossing the horizon of camera always need splitting.
+    const double invalid = numeric_limits<double>().max();
+    int invalid_corners = ( _pt_a.x == invalid ) + ( _pt_b.x == invalid ) + ( _pt_c.x == invalid ) + ( _pt_d.x == invalid );
+    if ( invalid_corners == 4 )
+    {
+        return 0.0;
+    }
+    if ( invalid_corners > 0 )
+    {
+        return numeric_limits<double>().infinity();
+    }
+    // Samples a grid across mesh, dense enough that a mesh only partly on frame still has samples on frame.
+    // Corners are left out, as they are projected exactly.
+    const int grid_size = 5;
+    const int sample_count = grid_size * grid_size - 4;
+    Point canvas_samples[sample_count];
+    int sample_index = 0;
+    for ( int j=0; j<grid_size; j++ )
+    {
+        for ( int i=0; i<grid_size; i++ )
+        {
+            if ( ( i == 0 || i == grid_size - 1 ) && ( j == 0 || j == grid_size - 1 ) )
+            {
+                continue;
+            }
+            canvas_samples[sample_index++] = Point ( _x_1 + ( _x_2 - _x_1 ) * i / ( grid_size - 1 ), _y_1 + ( _y_2 - _y_1 ) * j / ( grid_size - 1 ) );
+        }
+    }
+    double sphere_samples[sample_count][3];
+    for ( int k=0; k<sample_count; k++ )
+    {
+        Point3d sphere_sample = projection.GetSpherePoint ( canvas_samples[k], canvas_size );
+        sphere_samples[k][0] = sphere_sample.x;
+        sphere_samples[k][1] = sphere_sample.y;
+        sphere_samples[k][2] = sphere_sample.z;
+    }
+    double frame_samples[sample_count][2];
+    camera.ProjectWorldToFrame ( sphere_samples[0], sample_count, frame_samples[0] );
+    // Only counts samples landing on frame, either exactly or interpolated.
+    Size frame_size = camera.GetFrameSize();
+    double max_error = 0.0;
+    for ( int k=0; k<sample_count; k++ )
+    {
+        Point2d exact_pt ( frame_samples[k][0], frame_samples[k][1] );
+        Point2d interpolated_pt = Interpolate ( canvas_samples[k].x, canvas_samples[k].y );
+        if ( IsOutOfBound ( exact_pt, frame_size.width, frame_size.height )
+                && IsOutOfBound ( interpolated_pt, frame_size.width, frame_size.height ) )
+        {
+            continue;
+        }
+        if ( exact_pt.x == invalid )
+        {
+            return numeric_limits<double>().infinity();
+        }
+        max_error = max ( max_error, cv::norm ( exact_pt - interpolated_pt ) );
+    }
+    return max_error;
+}
+
+bool Mesh::CanSplit ( const int min_mesh_size ) const
+{
+    return _x_2 - _x_1 + 1 >= 2 * min_mesh_size || _y_2 - _y_1 + 1 >= 2 * min_mesh_size;
+}
+
+vector<Mesh> Mesh::Split ( const int min_mesh_size, const Size& canvas_size, const OutputProjection& projection,
+                          const Camera& camera ) const
+{
+    // Splits each side in halves if both halves are no smaller than minimum size.
+    vector<pair<int, int>> x_ranges ( 1, make_pair ( _x_1, _x_2 ) );
+    vector<pair<int, int>> y_ranges ( 1, make_pair ( _y_1, _y_2 ) );
+    if ( _x_2 - _x_1 + 1 >= 2 * min_mesh_size )
+    {
+        int x_m = ( _x_1 + _x_2 ) / 2;
+        x_ranges = { make_pair ( _x_1, x_m ), make_pair ( x_m + 1, _x_2 ) };
+    }
+    if ( _y_2 - _y_1 + 1 >= 2 * min_mesh_size )
+    {
+        int y_m = ( _y_1 + _y_2 ) / 2;
+        y_ranges = { make_pair ( _y_1, y_m ), make_pair ( y_m + 1, _y_2 ) };
+    }
+    vector<Mesh> meshes;
+    for ( const auto& y_range : y_ranges )
+    {
+        for ( const auto& x_range : x_ranges )
+        {
+            meshes.push_back ( Mesh ( x_range.first, y_range.first, x_range.second, y_range.second, canvas_size, projection, camera ) );
+        }
+    }
+    return meshes;
+}
+
+void Mesh::ComputeWeights ( const Camera& camera, Mat* weight_mat, const Point& weight_origin ) const
+{
+    int frame_width = camera.GetFrameSize().width;
+    int frame_height = camera.GetFrameSize().height;
     // Calculates local weight for each pixel in mesh as 1/rho.
     Point2d center = camera.GetCameraCenter();
     for ( int p_y=_y_1; p_y<=_y_2; p_y++ )
     {
         for ( int p_x=_x_1; p_x<=_x_2; p_x++ )
         {
-            double a_x = ( double ) ( p_x - _x_1 ) / ( _x_2 - _x_1 );
-            double a_y = ( double ) ( p_y - _y_1 ) / ( _y_2 - _y_1 );
-            Point2d pt = ( 1 - a_y ) * ( ( 1 - a_x ) * _pt_a + a_x * _pt_b )
-                         + a_y * ( ( 1 - a_x ) *_pt_c + a_x * _pt_d );
+            Point2d pt = Interpolate ( p_x, p_y );
             double rho = cv::norm ( pt - center );
             double weight = 0.0;
             if ( rho == 0 )
@@ -49,51 +168,39 @@ Mesh::Mesh ( const int row_index, const int col_index, const int mesh_size,
             {
                 weight = 1.0 / rho;
             }
-            weight_mat->at<double> ( p_y, p_x ) = weight;
+            weight_mat->at<double> ( p_y - weight_origin.y, p_x - weight_origin.x ) = weight;
         }
     }
 }
 
-bool Mesh::CheckValidity ( const Camera& camera )
+void Mesh::AppendRemapEntries ( const int p_y, const Size& canvas_size, const Size& frame_size, RemapTable* table ) const
 {
-    Size frameSize = camera.GetFrameSize();
-    int width = frameSize.width;
-    int height = frameSize.height;
-    return !IsOutOfBound ( _pt_a, width, height ) || !IsOutOfBound ( _pt_b, width, height )
-           || !IsOutOfBound ( _pt_c, width, height ) || !IsOutOfBound ( _pt_d, width, height );
-}
-
-void Mesh::Paint ( Mat* canvas, const Mat& frame, const Mat& weight_mat )
-{
-    int width = frame.cols;
-    int height = frame.rows;
+    if ( p_y < _y_1 || p_y > _y_2 )
+    {
+        return;
+    }
+    int width = frame_size.width;
+    int height = frame_size.height;
     for ( int p_x=_x_1; p_x<=_x_2; p_x++ )
     {
-        for ( int p_y=_y_1; p_y<=_y_2; p_y++ )
+        Point2d pt = Interpolate ( p_x, p_y );
+        if ( IsOutOfBound ( pt, width, height ) )
         {
-            double a_x = ( double ) ( p_x - _x_1 ) / ( _x_2 - _x_1 );
-            double a_y = ( double ) ( p_y - _y_1 ) / ( _y_2 - _y_1 );
-            Point2d pt = ( 1 - a_y ) * ( ( 1 - a_x ) * _pt_a + a_x * _pt_b )
-                         + a_y * ( ( 1 - a_x ) *_pt_c + a_x * _pt_d );
-            if ( IsOutOfBound ( pt, width, height ) )
-            {
-                continue;
-            }
-            Vec3b pixel = frame.at<Vec3b> ( pt.y, pt.x );
-            double weight = weight_mat.at<double> ( p_y, p_x );
-            if ( weight > 0.5+_blending_weight_th )
-            {
-                canvas->at<Vec3b> ( p_y, p_x ) = pixel;
-            }
-            else if ( weight > 0.5-_blending_weight_th )
-            {
-                canvas->at<Vec3b> ( p_y,p_x ) += ( weight-0.5+_blending_weight_th ) / ( 2*_blending_weight_th ) * pixel;
-            }
+            continue;
         }
+        table->Append ( p_y * canvas_size.width + p_x, ( short ) pt.x, ( short ) pt.y );
     }
 }
 
-bool Mesh::IsOutOfBound ( const Point2d& pt, const int width, const int height )
+Point2d Mesh::Interpolate ( const int p_x, const int p_y ) const
+{
+    double a_x = _x_2 > _x_1 ? ( double ) ( p_x - _x_1 ) / ( _x_2 - _x_1 ) : 0.0;
+    double a_y = _y_2 > _y_1 ? ( double ) ( p_y - _y_1 ) / ( _y_2 - _y_1 ) : 0.0;
+    return ( 1 - a_y ) * ( ( 1 - a_x ) * _pt_a + a_x * _pt_b )
+           + a_y * ( ( 1 - a_x ) *_pt_c + a_x * _pt_d );
+}
+
+bool Mesh::IsOutOfBound ( const Point2d& pt, const int width, const int height ) const
 {
     return pt.x < 0 || pt.y < 0 || pt.x >= width || pt.y >= height;
 }
@@ -0,0 +1,93 @@
+#include "output_projection.h"
+
+// World has z to the front, x to the right and y downwards. Faces are listed in canvas order.
+const OutputProjection::CubeFace OutputProjection::kCubeFaces[6] =
+{
+    { Point3d ( -1, 0, 0 ), Point3d ( 0, 0, 1 ), Point3d ( 0, 1, 0 ) },   // Left
+    { Point3d ( 0, 0, 1 ), Point3d ( 1, 0, 0 ), Point3d ( 0, 1, 0 ) },    // Front
+    { Point3d ( 1, 0, 0 ), Point3d ( 0, 0, -1 ), Point3d ( 0, 1, 0 ) },   // Right
+    { Point3d ( 0, 1, 0 ), Point3d ( 1, 0, 0 ), Point3d ( 0, 0, -1 ) },   // Bottom
+    { Point3d ( 0, 0, -1 ), Point3d ( -1, 0, 0 ), Point3d ( 0, 1, 0 ) },  // Back
+    { Point3d ( 0, -1, 0 ), Point3d ( 1, 0, 0 ), Point3d ( 0, 0, 1 ) }    // Top
+};
+
+Size OutputProjection::GetCanvasSize ( const int equirectangular_width ) const
+{
+    if ( _type == PROJECTION_EQUIRECTANGULAR )
+    {
+        int width = equirectangular_width / 4 * 4;
+        return Size ( width, width / 2 );
+    }
+    // Each face spans a quarter of the equator.
+    int face_size = equirectangular_width / 4 / 2 * 2;
+    return Size ( 3 * face_size, 2 * face_size );
+}
+
+vector<Rect> OutputProjection::GetFaceRects ( const Size& canvas_size ) const
+{
+    vector<Rect> face_rects;
+    if ( _type == PROJECTION_EQUIRECTANGULAR )
+    {
+        face_rects.push_back ( Rect ( Point ( 0, 0 ), canvas_size ) );
+        return face_rects;
+    }
+    int face_size = canvas_size.height / 2;
+    for ( int face=0; face<6; face++ )
+    {
+        face_rects.push_back ( Rect ( face % 3 * face_size, face / 3 * face_size, face_size, face_size ) );
+    }
+    return face_rects;
+}
+
+Point3d OutputProjection::GetSpherePoint ( const Point2d& screen_point, const Size& canvas_size ) const
+{
+    if ( _type == PROJECTION_EQUIRECTANGULAR )
+    {
+        return Utils::GetSpherePointFromScreenPoint ( screen_point, canvas_size, 1.0 );
+    }
+    int face_size = canvas_size.height / 2;
+    int face_col = min ( max ( cvFloor ( screen_point.x / face_size ), 0 ), 2 );
+    int face_row = min ( max ( cvFloor ( screen_point.y / face_size ), 0 ), 1 );
+    const CubeFace& face = kCubeFaces[face_row * 3 + face_col];
+    // Position of pixel center on face in [-1, 1].
+    double a = ( 2.0 * ( screen_point.x - face_col * face_size ) + 1.0 ) / face_size - 1.0;
+    double b = ( 2.0 * ( screen_point.y - face_row * face_size ) + 1.0 ) / face_size - 1.0;
+    if ( _type == PROJECTION_EQUIANGULAR_CUBEMAP )
+    {
+        a = tan ( a * M_PI / 4.0 );
+        b = tan ( b * M_PI / 4.0 );
+    }
+    Point3d sphere_point = face.forward + a * face.right + b * face.down;
+    return sphere_point * ( 1.0 / cv::norm ( sphere_point ) );
+}
+
+Point2d OutputProjection::GetScreenPoint ( const Point3d& sphere_point, const Size& canvas_size ) const
+{
+    if ( _type == PROJECTION_EQUIRECTANGULAR )
+    {
+        return Utils::GetScreenPointFromSpherePoint ( sphere_point, canvas_size );
+    }
+    // Finds the face the point is projected on.
+    int best_face = 0;
+    double best_depth = -numeric_limits<double>().max();
+    for ( int face=0; face<6; face++ )
+    {
+        double depth = kCubeFaces[face].forward.dot ( sphere_point );
+        if ( depth > best_depth )
+        {
+            best_depth = depth;
+            best_face = face;
+        }
+    }
+    const CubeFace& face = kCubeFaces[best_face];
+    double a = face.right.dot ( sphere_point ) / best_depth;
+    double b = face.down.dot ( sphere_point ) / best_depth;
+    if ( _type == PROJECTION_EQUIANGULAR_CUBEMAP )
+    {
+        a = atan ( a ) * 4.0 / M_PI;
+        b = atan ( b ) * 4.0 / M_PI;
+    }
+    int face_size = canvas_size.height / 2;
+    return Point2d ( best_face % 3 * face_size + ( ( a + 1.0 ) * face_size - 1.0 ) / 2.0,
+                     best_face / 3 * face_size + ( ( b + 1.0 ) * face_size - 1.0 ) / 2.0 );
+}
@@ -1,7 +1,7 @@
 #include "pano_video_mapper.h"
 
 PanoVideoMapper::PanoVideoMapper ( const string& output_folder, const string& video_list_file )
-    : output_folder_(output_folder), fps_ ( 30 ), output_size_ ( 2000, 1000 )
+    : output_folder_(output_folder), fps_ ( 30 ), equirectangular_width_ ( 2000 ), weight_storage_ ( WEIGHT_STORAGE_FIXED_16 ), project_size_ ( 40 ), fixed_project_size_ ( 10 ), mesh_tolerance_ ( 0.5 ), decode_backend_ ( DECODE_BACKEND_VIDEO_CAPTURE ), decode_thread_count_ ( 0 ), paint_mode_ ( PAINT_MODE_GATHER ), stitch_color_ ( STITCH_COLOR_BGR ), paint_thread_count_ ( 0 ), paint_tile_height_ ( 16 ), pipeline_queue_capacity_ ( 4 ), preview_fps_ ( 0.0 ), preview_width_ ( 1000 ), track_drift_ ( false )
 {
     cout << "Input video list file: " << video_list_file << endl;
     cout << "Output result folder: " << output_folder << endl;
@@ -73,8 +73,19 @@ void PanoVideoMapper::ReadInVideoListFile(const string& video_list_file) {
     }
 }
 
-void PanoVideoMapper::GeneratePano(const string& calibration_file)
+void PanoVideoMapper::GeneratePano(const string& calibration_file, const vector<OutputRendition>& renditions)
 {
+    // Renditions are written to files after their names, so a repeated name would overwrite another rendition.
+    unordered_set<string> rendition_names;
+    for ( const OutputRendition& rendition : renditions )
+    {
+        if ( !rendition_names.insert ( rendition.name ).second )
+        {
+            cerr << "Output rendition name is used twice: " << rendition.name << endl;
+            exit ( -1 );
+        }
+    }
+
     // Trash all contents in output folder
     Utils::ClearFolder(output_folder_);
 
@@ -82,17 +93,17 @@ void PanoVideoMapper::GeneratePano(const string& calibration_file)
     cout << "\tLoading camera system calibration." << endl;
     ReadCameraCalibration ( calibration_file );
 
-    // Creates frame mappers for cameras.
-    Mat total_weight = Mat::zeros ( output_size_, CV_64FC1 );
-    for(const auto& camera_keyvalue_pair : cameras_map_){
-        FrameMapper frame_mapper (camera_keyvalue_pair.second, output_size_, 10);
-        frame_mapper_map_[camera_keyvalue_pair.first] = frame_mapper;
-        total_weight += frame_mapper.GetWeightMat();
-    }
-    // Normalizes weight mat in all frame mappers.
-    for(auto& frame_mapper_pair : frame_mapper_map_){
-        frame_mapper_pair.second.NormalizeWeight(total_weight);
+    // Creates frame mappers for cameras in each rendition.
+    vector<Size> output_sizes;
+    vector<unordered_map<string, FrameMapper>> frame_mapper_maps ( renditions.size() );
+    for ( unsigned r=0; r<renditions.size(); r++ )
+    {
+        output_sizes.push_back ( output_projection_.GetCanvasSize ( cvRound ( equirectangular_width_ * renditions[r].scale ) ) );
+        cout << "\tPreparing rendition " << renditions[r].name << " of " << output_sizes[r].width << "x" << output_sizes[r].height << "." << endl;
+        PrepareFrameMappers ( output_sizes[r], &frame_mapper_maps[r] );
     }
+    WorkStealingPool paint_pool ( paint_thread_count_ );
+    cout << "\tPainting with " << paint_pool.GetThreadCount() << " threads." << endl;
 
     for(const string& video_name : video_names_) {
         // Prepare parameters for synchronization.
@@ -111,60 +122,235 @@ void PanoVideoMapper::GeneratePano(const string& calibration_file)
         // Synchronizes videos and saves the result.
         cout << "\tSynchronizing input videos." << endl;
         CombinedVideoClip combined_videos = CombinedVideoClip ( synch_parameter );
+        combined_videos.SetDecodeBackend ( decode_backend_, decode_thread_count_ );
+        combined_videos.SetDriftTracking ( track_drift_ );
         combined_videos.LoadVideosWithFileNames ();
-        combined_videos.SynchronizeVideoWithAudio ();
+        combined_videos.SynchronizeVideoWithAudio ( remap_cache_folder_ );
         cout << "\tSaving synchronization result to output folder." << endl;
         combined_videos.SaveSynchronizationResult ( video_output_folder+"SynchedVideos.yaml" );
 
         // Stitching video.
         vector<string> camera_names = combined_videos.GetCameraNames();
-        namedWindow ( "Panoramic frame", CV_WINDOW_NORMAL );
-        resizeWindow ( "Panoramic frame", 1000, 500 );
-        // Note: Don't use MJPG (low compression and not work in high resolution, seems to be a bug in VideoCapture in opencv 3.4.1)
-        // Use MP4V instead. Ignore the warning "fallback to use tag 0x20", it seems ffmpeg use its own codec other than fourcc.
-        VideoWriter video_writer ( video_output_folder+"pano_video.mp4", CV_FOURCC ( 'M', 'P', '4', 'V' ), fps_, output_size_ );
-        double current_time = 0.0;
-        while ( true )
+        // Without preview no HighGUI function is called, so jobs run on machines without display.
+        unique_ptr<PreviewWindow> preview_window;
+        if ( preview_fps_ > 0.0 )
         {
-            bool more_frame = false;
-            Mat output_frame = Mat::zeros ( output_size_, CV_8UC3 );
-
-            vector<Mat> frame_vector = combined_videos.ReadFramesVector ( current_time, false );
-            // If all frames are empty, set flag to stop iteration.
-
-            for ( unsigned i=0; i<frame_vector.size(); i++ )
+            preview_window.reset ( new PreviewWindow ( "Panoramic frame", preview_fps_, preview_width_ ) );
+        }
+        // Encodes each rendition with libavcodec into its own file.
+        vector<unique_ptr<VideoEncoder>> video_encoders;
+        for ( unsigned r=0; r<renditions.size(); r++ )
+        {
+            string video_file = video_output_folder+renditions[r].name+".mp4";
+            video_encoders.emplace_back ( new VideoEncoder() );
+            if ( !video_encoders[r]->Open ( video_file, output_sizes[r], fps_, encoder_settings_ ) )
             {
-                if ( !frame_vector[i].empty() )
-                {
-                    more_frame = true;
-                    FrameMapper* frame_mapper = &frame_mapper_map_[camera_names[i]];
-                    frame_mapper->PaintOnCanvas ( frame_vector[i], &output_frame );
-                }
+                cerr << "Cannot create output video " << video_file << endl;
+                exit ( -1 );
             }
-            if ( !haar_cascade_.empty() )
+            cout << "\tEncoding " << video_file << " with " << video_encoders[r]->GetCodecName() << "." << endl;
+        }
+        // Merges frame mappers of each rendition in the order of frames, and for YUV also their chroma mappers
+        // shared by U and V planes.
+        bool stitch_yuv = stitch_color_ == STITCH_COLOR_YUV420 && !camera_names.empty();
+        vector<CanvasGatherer> canvas_gatherers;
+        vector<CanvasGatherer> chroma_gatherers;
+        if ( ( paint_mode_ == PAINT_MODE_GATHER || stitch_yuv ) && !camera_names.empty() )
+        {
+            for ( unsigned r=0; r<renditions.size(); r++ )
             {
-                // Perform face detection.
-                Mat gray;
-                cvtColor ( output_frame, gray, CV_BGR2GRAY );
-                vector<Rect_<int>> faces;
-                haar_cascade_.detectMultiScale ( gray, faces, 1.1, 4, 0, Size(10, 10), Size(100, 100));
-                for ( unsigned int i = 0; i<faces.size(); i++ )
+                vector<const FrameMapper*> frame_mappers;
+                for ( const string& camera_name : camera_names )
                 {
-                    Rect face_i = faces[i];
-                    rectangle ( output_frame, face_i, CV_RGB ( 0, 255, 0 ), 3 );
+                    frame_mappers.push_back ( &frame_mapper_maps[r].at ( camera_name ) );
+                }
+                canvas_gatherers.push_back ( CanvasGatherer ( frame_mappers ) );
+                if ( stitch_yuv )
+                {
+                    vector<FrameMapper> chroma_mappers;
+                    for ( const FrameMapper* frame_mapper : frame_mappers )
+                    {
+                        chroma_mappers.push_back ( frame_mapper->GetChromaMapper() );
+                    }
+                    vector<const FrameMapper*> chroma_mapper_pointers;
+                    for ( const FrameMapper& chroma_mapper : chroma_mappers )
+                    {
+                        chroma_mapper_pointers.push_back ( &chroma_mapper );
+                    }
+                    chroma_gatherers.push_back ( CanvasGatherer ( chroma_mapper_pointers ) );
                 }
             }
-            setWindowTitle ( "Panoramic frame", "Panoramic frame - time "+to_string ( current_time ) );
-            imshow ( "Panoramic frame", output_frame );
-            video_writer.write ( output_frame );
-            current_time += 1.0 / fps_;
-            char enter = cvWaitKey ( 1 );
-            if ( !more_frame || enter == 'q' )
+        }
+        // Decodes each camera on its own thread, stitches on this thread and encodes on another one, passing
+        // frames through bounded queues, so throughput follows the slowest stage instead of the sum of stages.
+        // Decoded frames are BGR frames, or I420 buffers of Y, U and V planes, and are empty while camera has
+        // no frame. Decoded frames and output frames are leased from pools holding every frame a queue, its
+        // producer and its consumer can keep at once, so leasing doesn't wait in steady state.
+        int camera_count = combined_videos.GetVideoCount();
+        int pool_capacity = pipeline_queue_capacity_ + 2;
+        vector<unique_ptr<FramePool>> decode_pools;
+        vector<unique_ptr<SpscQueue<Mat>>> decode_queues;
+        vector<thread> decode_threads;
+        // Error of each decoding thread, written before it closes its queue.
+        vector<exception_ptr> decode_errors ( camera_count );
+        for ( int i=0; i<camera_count; i++ )
+        {
+            Size frame_size = cameras_map_.at ( camera_names[i] ).GetFrameSize();
+            decode_pools.emplace_back ( stitch_yuv ? new FramePool ( pool_capacity, GetPlanesBufferSize ( frame_size ), CV_8UC1 )
+                                        : new FramePool ( pool_capacity, frame_size, CV_8UC3 ) );
+            decode_queues.emplace_back ( new SpscQueue<Mat> ( pipeline_queue_capacity_ ) );
+            decode_threads.emplace_back ( &PanoVideoMapper::DecodeFrames, this, combined_videos.GetVideoClip ( i ), stitch_yuv,
+                                          decode_pools[i].get(), decode_queues[i].get(), &decode_errors[i] );
+        }
+        vector<unique_ptr<FramePool>> output_pools;
+        for ( unsigned r=0; r<renditions.size(); r++ )
+        {
+            output_pools.emplace_back ( stitch_yuv ? new FramePool ( pool_capacity, GetPlanesBufferSize ( output_sizes[r] ), CV_8UC1 )
+                                        : new FramePool ( pool_capacity, output_sizes[r], CV_8UC3 ) );
+        }
+        SpscQueue<vector<Mat>> encode_queue ( pipeline_queue_capacity_ );
+        exception_ptr encode_error;
+        thread encode_thread ( &PanoVideoMapper::EncodeFrames, this, &encode_queue, &video_encoders, &output_pools, &encode_error );
+        // YUV output frames are encoded as they are painted, and only the shown one is converted to BGR.
+        vector<Mat> decoded_frames ( camera_count );
+        vector<Mat> output_frames ( renditions.size() );
+        Mat gray;
+        double current_time = 0.0;
+        // Errors of any stage stop the pipeline, and are rethrown here once all threads are joined, as an
+        // exception escaping a thread would terminate the process without a message.
+        exception_ptr stitch_error;
+        try
+        {
+            while ( true )
             {
-                break;
+                // Takes frames of all cameras at current time, where cameras whose decoding has stopped give no frame.
+                // If all frames are empty, or decoding of any camera has failed, stops iteration.
+                bool more_frame = false;
+                bool decode_failed = false;
+                for ( int i=0; i<camera_count; i++ )
+                {
+                    if ( !decode_queues[i]->Pop ( &decoded_frames[i] ) )
+                    {
+                        decoded_frames[i] = Mat();
+                        decode_failed = decode_failed || decode_errors[i];
+                    }
+                    more_frame = more_frame || !decoded_frames[i].empty();
+                }
+                if ( !more_frame || decode_failed )
+                {
+                    break;
+                }
+                // Stitches the same frames in each rendition, the first one being shown and searched for faces.
+                // Gathered canvases are fully overwritten, so only scattered ones are cleared first.
+                for ( unsigned r=0; r<renditions.size(); r++ )
+                {
+                    output_frames[r] = output_pools[r]->Lease();
+                    if ( stitch_yuv )
+                    {
+                        StitchPlanes ( decoded_frames, canvas_gatherers[r], chroma_gatherers[r], &paint_pool, &output_frames[r] );
+                    }
+                    else if ( !canvas_gatherers.empty() )
+                    {
+                        GatherFrames ( decoded_frames, canvas_gatherers[r], &paint_pool, &output_frames[r] );
+                    }
+                    else
+                    {
+                        output_frames[r].setTo ( Scalar::all ( 0 ) );
+                        PaintFrames ( decoded_frames, camera_names, frame_mapper_maps[r], &paint_pool, &output_frames[r] );
+                    }
+                }
+                // Decoded frames are no longer read once painted.
+                for ( int i=0; i<camera_count; i++ )
+                {
+                    decode_pools[i]->Return ( decoded_frames[i] );
+                    decoded_frames[i] = Mat();
+                }
+                Mat output_frame = output_frames.empty() ? Mat() : output_frames[0];
+                Mat output_planes[3];
+                if ( stitch_yuv && !output_frame.empty() )
+                {
+                    SplitPlanes ( output_frame, output_sizes[0], output_planes );
+                }
+                if ( !haar_cascade_.empty() && !output_frame.empty() )
+                {
+                    // Perform face detection, on the Y plane of YUV frames as it is already grayscale.
+                    if ( stitch_yuv )
+                    {
+                        gray = output_planes[0];
+                    }
+                    else
+                    {
+                        cvtColor ( output_frame, gray, CV_BGR2GRAY );
+                    }
+                    vector<Rect_<int>> faces;
+                    haar_cascade_.detectMultiScale ( gray, faces, 1.1, 4, 0, Size(10, 10), Size(100, 100));
+                    for ( unsigned int i = 0; i<faces.size(); i++ )
+                    {
+                        Rect face_i = faces[i];
+                        if ( stitch_yuv )
+                        {
+                            DrawRectangleOnPlanes ( output_planes, face_i, CV_RGB ( 0, 255, 0 ), 3 );
+                        }
+                        else
+                        {
+                            rectangle ( output_frame, face_i, CV_RGB ( 0, 255, 0 ), 3 );
+                        }
+                    }
+                }
+                // Preview takes a scaled copy only when it is due and idle, before frames are handed to encoder.
+                if ( preview_window && !output_frame.empty() )
+                {
+                    if ( stitch_yuv )
+                    {
+                        preview_window->OfferPlanes ( output_planes, current_time );
+                    }
+                    else
+                    {
+                        preview_window->Offer ( output_frame, current_time );
+                    }
+                }
+                // Output frames go back to their pools once written. Encoder closes queue if it fails.
+                if ( !encode_queue.Push ( output_frames ) )
+                {
+                    break;
+                }
+                current_time += 1.0 / fps_;
+                if ( preview_window && preview_window->IsQuitRequested() )
+                {
+                    break;
+                }
             }
         }
-        video_writer.release();
+        catch ( ... )
+        {
+            stitch_error = current_exception();
+        }
+        // Stops decoders, which may be waiting on full queues, and lets encoder finish queued frames.
+        for ( int i=0; i<camera_count; i++ )
+        {
+            decode_queues[i]->Close();
+            decode_threads[i].join();
+        }
+        encode_queue.Close();
+        encode_thread.join();
+        for ( const exception_ptr& error : decode_errors )
+        {
+            stitch_error = stitch_error ? stitch_error : error;
+        }
+        stitch_error = stitch_error ? stitch_error : encode_error;
+        if ( stitch_error )
+        {
+            rethrow_exception ( stitch_error );
+        }
+        for ( unique_ptr<VideoEncoder>& video_encoder : video_encoders )
+        {
+            video_encoder->Close();
+        }
+        for ( int i=0; i<camera_count; i++ )
+        {
+            PrintQueueStats ( "decoding " + camera_names[i], decode_queues[i]->GetStats(), pipeline_queue_capacity_ );
+        }
+        PrintQueueStats ( "encoding", encode_queue.GetStats(), pipeline_queue_capacity_ );
     }
 }
 
@@ -196,18 +382,21 @@ void PanoVideoMapper::SaveSamples(const float sample_rate)
         // Synchronizes videos and saves the result.
         cout << "\tSynchronizing input videos." << endl;
         CombinedVideoClip combined_videos = CombinedVideoClip ( synch_parameter );
+        combined_videos.SetDecodeBackend ( decode_backend_, decode_thread_count_ );
+        combined_videos.SetDriftTracking ( track_drift_ );
         combined_videos.LoadVideosWithFileNames ();
-        combined_videos.SynchronizeVideoWithAudio ();
+        combined_videos.SynchronizeVideoWithAudio ( remap_cache_folder_ );
         cout << "\tSaving synchronization result to output folder." << endl;
         combined_videos.SaveSynchronizationResult ( video_output_folder + "SynchedVideos.yaml" );
 
         // Go over whole video to collect samples based on sample rate.
         double current_time = 5.0;
         vector<string> camera_names_from_combined_video = combined_videos.GetCameraNames();
+        vector<Mat> frame_vector;
         while(true) {
             bool more_frame = false;
             bool all_visible = true;
-            vector<Mat> frame_vector = combined_videos.ReadFramesVector(current_time, false);
+            combined_videos.ReadFramesVector(current_time, false, &frame_vector);
             for(unsigned i=0; i<frame_vector.size(); i++) {
                 if(frame_vector[i].empty()) {
                     all_visible = false;
@@ -246,6 +435,300 @@ void PanoVideoMapper::EnableFaceDetection()
     }
 }
 
+void PanoVideoMapper::SetPaintThreadCount ( const int thread_count )
+{
+    paint_thread_count_ = thread_count;
+}
+
+void PanoVideoMapper::PrepareFrameMappers ( const Size& output_size, unordered_map<string, FrameMapper>* frame_mapper_map )
+{
+    int project_size = mesh_tolerance_ > 0.0 ? project_size_ : fixed_project_size_;
+    uint64_t cache_key = RemapCache::ComputeKey ( cameras_map_, output_size, project_size, mesh_tolerance_, weight_storage_,
+                                                  output_projection_.GetType() );
+    string cache_file = remap_cache_folder_.empty() ? "" : RemapCache::GetFileName ( remap_cache_folder_, cache_key );
+    if ( !cache_file.empty() && RemapCache::Load ( cache_file, cache_key, cameras_map_, output_size, frame_mapper_map ) )
+    {
+        cout << "\tLoaded frame mappers from remap cache " << cache_file << endl;
+        return;
+    }
+
+    // Builds frame mappers for cameras.
+    Mat total_weight = Mat::zeros ( output_size, CV_64FC1 );
+    for(const auto& camera_keyvalue_pair : cameras_map_){
+        FrameMapper frame_mapper (camera_keyvalue_pair.second, output_size, project_size, weight_storage_, mesh_tolerance_, output_projection_);
+        ( *frame_mapper_map ) [camera_keyvalue_pair.first] = frame_mapper;
+        cout << "\t" << camera_keyvalue_pair.first << ": " << frame_mapper.GetMeshCount() << " meshes, maximum interpolation error "
+             << frame_mapper.GetMaxMeshError() << " pixels." << endl;
+        Mat total_weight_roi = total_weight ( frame_mapper.GetWeightRoi() );
+        total_weight_roi += frame_mapper.GetWeightMat();
+    }
+    // Normalizes weight mat in all frame mappers.
+    for(auto& frame_mapper_pair : *frame_mapper_map){
+        frame_mapper_pair.second.NormalizeWeight(total_weight);
+        cout << "\t" << frame_mapper_pair.first << ": " << frame_mapper_pair.second.GetCopySpanCount() << " copied runs, "
+             << frame_mapper_pair.second.GetBlendSpanCount() << " blended runs." << endl;
+    }
+    // Total weight is only needed for normalization.
+    total_weight.release();
+    cout << "\tNormalized weights kept with maximum error " << FrameMapper::GetMaxQuantizationError ( weight_storage_ ) << "." << endl;
+
+    if ( !cache_file.empty() )
+    {
+        Utils::CreateFolderIfNotExists ( remap_cache_folder_ );
+        if ( RemapCache::Save ( cache_file, cache_key, *frame_mapper_map ) )
+        {
+            cout << "\tSaved frame mappers to remap cache " << cache_file << endl;
+        }
+        else
+        {
+            cerr << "\tCannot save remap cache " << cache_file << endl;
+        }
+    }
+}
+
+void PanoVideoMapper::SetMeshTolerance ( const double mesh_tolerance )
+{
+    mesh_tolerance_ = mesh_tolerance;
+}
+
+void PanoVideoMapper::SetRemapCacheFolder ( const string& remap_cache_folder )
+{
+    remap_cache_folder_ = remap_cache_folder;
+}
+
+void PanoVideoMapper::SetOutputProjection ( const ProjectionType projection_type )
+{
+    output_projection_ = OutputProjection ( projection_type );
+}
+
+void PanoVideoMapper::SetDecodeBackend ( const DecodeBackend decode_backend, const int decode_thread_count )
+{
+    decode_backend_ = decode_backend;
+    decode_thread_count_ = decode_thread_count;
+}
+
+void PanoVideoMapper::SetPaintMode ( const PaintMode paint_mode )
+{
+    paint_mode_ = paint_mode;
+}
+
+void PanoVideoMapper::SetDriftTracking ( const bool track_drift )
+{
+    track_drift_ = track_drift;
+}
+
+void PanoVideoMapper::SetPreviewRate ( const double preview_fps )
+{
+    preview_fps_ = preview_fps;
+}
+
+void PanoVideoMapper::SetEncoderSettings ( const EncoderSettings& encoder_settings )
+{
+    encoder_settings_ = encoder_settings;
+}
+
+void PanoVideoMapper::SetStitchColor ( const StitchColor stitch_color )
+{
+    stitch_color_ = stitch_color;
+}
+
+void PanoVideoMapper::SetWeightStorage ( const WeightStorage weight_storage )
+{
+    weight_storage_ = weight_storage;
+}
+
+void PanoVideoMapper::PaintFrames ( const vector<Mat>& frame_vector, const vector<string>& camera_names,
+                                    const unordered_map<string, FrameMapper>& frame_mapper_map, WorkStealingPool* paint_pool, Mat* canvas )
+{
+    // Collects mappers of available frames in camera order.
+    vector<const FrameMapper*> frame_mappers;
+    vector<const Mat*> frames;
+    for ( unsigned i=0; i<frame_vector.size(); i++ )
+    {
+        if ( !frame_vector[i].empty() )
+        {
+            frame_mappers.push_back ( &frame_mapper_map.at ( camera_names[i] ) );
+            frames.push_back ( &frame_vector[i] );
+        }
+    }
+    // Each tile is painted by one thread with all cameras in the same order as serial painting,
+    // so the canvas doesn't depend on the number of threads.
+    int tile_count = ( canvas->rows + paint_tile_height_ - 1 ) / paint_tile_height_;
+    paint_pool->ParallelFor ( tile_count, [&] ( int tile_index )
+    {
+        int row_begin = tile_index * paint_tile_height_;
+        int row_end = min ( row_begin + paint_tile_height_, canvas->rows );
+        for ( unsigned i=0; i<frame_mappers.size(); i++ )
+        {
+            frame_mappers[i]->PaintOnCanvas ( *frames[i], canvas, row_begin, row_end );
+        }
+    } );
+}
+
+void PanoVideoMapper::GatherFrames ( const vector<Mat>& frame_vector, const CanvasGatherer& canvas_gatherer,
+                                     WorkStealingPool* paint_pool, Mat* canvas, const uchar fill_value )
+{
+    int tile_count = ( canvas->rows + paint_tile_height_ - 1 ) / paint_tile_height_;
+    paint_pool->ParallelFor ( tile_count, [&] ( int tile_index )
+    {
+        int row_begin = tile_index * paint_tile_height_;
+        int row_end = min ( row_begin + paint_tile_height_, canvas->rows );
+        canvas_gatherer.PaintOnCanvas ( frame_vector, canvas, row_begin, row_end, fill_value );
+    } );
+}
+
+void PanoVideoMapper::StitchPlanes ( const vector<Mat>& frame_buffers, const CanvasGatherer& luma_gatherer,
+                                     const CanvasGatherer& chroma_gatherer, WorkStealingPool* paint_pool, Mat* yuv_canvas )
+{
+    // Splits planes of each camera into planes of the same kind, leaving planes of missing frames empty.
+    const vector<Size>& frame_sizes = luma_gatherer.GetFrameSizes();
+    vector<vector<Mat>> frame_planes ( 3, vector<Mat> ( frame_buffers.size() ) );
+    for ( unsigned i=0; i<frame_buffers.size(); i++ )
+    {
+        if ( !frame_buffers[i].empty() )
+        {
+            Mat planes[3];
+            SplitPlanes ( frame_buffers[i], frame_sizes[i], planes );
+            for ( int p=0; p<3; p++ )
+            {
+                frame_planes[p][i] = planes[p];
+            }
+        }
+    }
+    Size luma_size = luma_gatherer.GetOutputSize();
+    CV_Assert ( luma_size.width % 2 == 0 && luma_size.height % 2 == 0 );
+    Mat canvas_planes[3];
+    SplitPlanes ( *yuv_canvas, luma_size, canvas_planes );
+    // Uncovered pixels are black, which is zero luma with neutral chroma.
+    GatherFrames ( frame_planes[0], luma_gatherer, paint_pool, &canvas_planes[0], 0 );
+    GatherFrames ( frame_planes[1], chroma_gatherer, paint_pool, &canvas_planes[1], 128 );
+    GatherFrames ( frame_planes[2], chroma_gatherer, paint_pool, &canvas_planes[2], 128 );
+}
+
+void PanoVideoMapper::DecodeFrames ( VideoClip* video_clip, const bool read_planes, FramePool* frame_pool,
+                                     SpscQueue<Mat>* decode_queue, exception_ptr* error )
+{
+    try
+    {
+        vector<Mat> planes;
+        for ( long frame_index=0; ; frame_index++ )
+        {
+            double global_time = ( double ) frame_index / fps_;
+            Mat frame = frame_pool->Lease();
+            bool has_frame = false;
+            if ( read_planes )
+            {
+                // Decoded planes are valid only until the next read, so they are copied to the leased buffer.
+                has_frame = video_clip->ReadSynchedPlanes ( global_time, &planes );
+                if ( has_frame )
+                {
+                    Mat frame_planes[3];
+                    SplitPlanes ( frame, planes[0].size(), frame_planes );
+                    for ( int p=0; p<3; p++ )
+                    {
+                        planes[p].copyTo ( frame_planes[p] );
+                    }
+                }
+            }
+            else
+            {
+                has_frame = video_clip->ReadSynchedFrame ( global_time, &frame );
+            }
+            if ( !has_frame )
+            {
+                frame_pool->Return ( frame );
+                frame = Mat();
+                if ( video_clip->HasFinished ( global_time ) )
+                {
+                    break;
+                }
+            }
+            if ( !decode_queue->Push ( frame ) )
+            {
+                frame_pool->Return ( frame );
+                break;
+            }
+        }
+    }
+    catch ( ... )
+    {
+        *error = current_exception();
+    }
+    decode_queue->Close();
+}
+
+void PanoVideoMapper::EncodeFrames ( SpscQueue<vector<Mat>>* encode_queue, vector<unique_ptr<VideoEncoder>>* video_encoders,
+                                     vector<unique_ptr<FramePool>>* output_pools, exception_ptr* error )
+{
+    try
+    {
+        vector<Mat> output_frames;
+        while ( encode_queue->Pop ( &output_frames ) )
+        {
+            for ( unsigned r=0; r<output_frames.size(); r++ )
+            {
+                VideoEncoder* video_encoder = ( *video_encoders ) [r].get();
+                bool written = false;
+                if ( output_frames[r].type() == CV_8UC1 )
+                {
+                    Mat planes[3];
+                    SplitPlanes ( output_frames[r], video_encoder->GetFrameSize(), planes );
+                    written = video_encoder->WritePlanes ( planes );
+                }
+                else
+                {
+                    written = video_encoder->Write ( output_frames[r] );
+                }
+                if ( !written )
+                {
+                    cerr << "Fail to encode frame of rendition " << r << endl;
+                }
+                ( *output_pools ) [r]->Return ( output_frames[r] );
+            }
+        }
+    }
+    catch ( ... )
+    {
+        *error = current_exception();
+        encode_queue->Close();
+    }
+}
+
+void PanoVideoMapper::DrawRectangleOnPlanes ( Mat planes[3], const Rect& rect, const Scalar& color, const int thickness )
+{
+    // Converts color the way frames are converted, through a block sharing one chroma sample.
+    Mat color_block ( 2, 2, CV_8UC3, color );
+    Mat yuv_block;
+    cvtColor ( color_block, yuv_block, COLOR_BGR2YUV_I420 );
+    rectangle ( planes[0], rect, Scalar ( yuv_block.data[0] ), thickness );
+    Rect chroma_rect ( rect.x / 2, rect.y / 2, rect.width / 2, rect.height / 2 );
+    int chroma_thickness = max ( 1, thickness / 2 );
+    rectangle ( planes[1], chroma_rect, Scalar ( yuv_block.data[4] ), chroma_thickness );
+    rectangle ( planes[2], chroma_rect, Scalar ( yuv_block.data[5] ), chroma_thickness );
+}
+
+Size PanoVideoMapper::GetPlanesBufferSize ( const Size& luma_size )
+{
+    Size chroma_size ( ( luma_size.width + 1 ) / 2, ( luma_size.height + 1 ) / 2 );
+    return Size ( luma_size.area() + 2 * chroma_size.area(), 1 );
+}
+
+void PanoVideoMapper::SplitPlanes ( const Mat& buffer, const Size& luma_size, Mat planes[3] )
+{
+    Size chroma_size ( ( luma_size.width + 1 ) / 2, ( luma_size.height + 1 ) / 2 );
+    CV_Assert ( buffer.type() == CV_8UC1 && buffer.isContinuous() && ( int ) buffer.total() == GetPlanesBufferSize ( luma_size ).width );
+    planes[0] = Mat ( luma_size, CV_8UC1, buffer.data );
+    planes[1] = Mat ( chroma_size, CV_8UC1, buffer.data + luma_size.area() );
+    planes[2] = Mat ( chroma_size, CV_8UC1, buffer.data + luma_size.area() + chroma_size.area() );
+}
+
+void PanoVideoMapper::PrintQueueStats ( const string& stage_name, const QueueStats& stats, const int capacity )
+{
+    cout << "\tQueue of " << stage_name << ": " << stats.push_count << " frames, mean depth " << stats.GetMeanDepth()
+         << " and max depth " << stats.max_depth << " of " << capacity << ", producer blocked " << stats.full_waits
+         << " times, consumer starved " << stats.empty_waits << " times." << endl;
+}
+
 void PanoVideoMapper::ReadCameraCalibration ( const string& calibration_file )
 {
     if ( !Utils::FileExists ( calibration_file ) )
@@ -0,0 +1,133 @@
+#include "preview_window.h"
+
+PreviewWindow::PreviewWindow ( const string& window_name, const double max_fps, const int max_width )
+    : _window_name ( window_name ), _min_interval ( max_fps > 0.0 ? 1.0 / max_fps : 0.0 ), _max_width ( max_width ),
+      _quit_requested ( false )
+{
+    _thread = thread ( &PreviewWindow::ShowLoop, this );
+}
+
+PreviewWindow::~PreviewWindow()
+{
+    {
+        lock_guard<mutex> lock ( _frame_mutex );
+        _stopping = true;
+    }
+    _frame_condition.notify_all();
+    _thread.join();
+}
+
+bool PreviewWindow::Offer ( const Mat& frame, const double time )
+{
+    // Gives up at once if window thread holds the frame, has not shown the last one, or preview isn't due.
+    unique_lock<mutex> lock ( _frame_mutex, try_to_lock );
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    if ( !lock.owns_lock() || _has_pending || frame.empty()
+            || ( _has_taken && chrono::duration<double> ( now - _last_taken ).count() < _min_interval ) )
+    {
+        return false;
+    }
+    resize ( frame, _pending_frame, GetPreviewSize ( frame.size() ), 0, 0, INTER_AREA );
+    _pending_yuv = false;
+    _pending_time = time;
+    _has_pending = true;
+    _last_taken = now;
+    _has_taken = true;
+    lock.unlock();
+    _frame_condition.notify_one();
+    return true;
+}
+
+bool PreviewWindow::OfferPlanes ( const Mat planes[3], const double time )
+{
+    unique_lock<mutex> lock ( _frame_mutex, try_to_lock );
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    if ( !lock.owns_lock() || _has_pending || planes[0].empty()
+            || ( _has_taken && chrono::duration<double> ( now - _last_taken ).count() < _min_interval ) )
+    {
+        return false;
+    }
+    // Scales each plane into its place in an I420 image.
+    Size preview_size = GetPreviewSize ( planes[0].size() );
+    Size chroma_size ( preview_size.width / 2, preview_size.height / 2 );
+    _pending_frame.create ( preview_size.height * 3 / 2, preview_size.width, CV_8UC1 );
+    Mat pending_planes[3] =
+    {
+        Mat ( preview_size, CV_8UC1, _pending_frame.data ),
+        Mat ( chroma_size, CV_8UC1, _pending_frame.data + preview_size.area() ),
+        Mat ( chroma_size, CV_8UC1, _pending_frame.data + preview_size.area() + chroma_size.area() )
+    };
+    for ( int p=0; p<3; p++ )
+    {
+        resize ( planes[p], pending_planes[p], pending_planes[p].size(), 0, 0, INTER_AREA );
+    }
+    _pending_yuv = true;
+    _pending_time = time;
+    _has_pending = true;
+    _last_taken = now;
+    _has_taken = true;
+    lock.unlock();
+    _frame_condition.notify_one();
+    return true;
+}
+
+Size PreviewWindow::GetPreviewSize ( const Size& frame_size ) const
+{
+    double scale = min ( 1.0, ( double ) _max_width / frame_size.width );
+    return Size ( max ( 2, cvRound ( frame_size.width * scale ) / 2 * 2 ), max ( 2, cvRound ( frame_size.height * scale ) / 2 * 2 ) );
+}
+
+void PreviewWindow::ShowLoop()
+{
+    namedWindow ( _window_name, WINDOW_NORMAL );
+    Mat taken_frame;
+    Mat shown_frame;
+    bool window_sized = false;
+    while ( true )
+    {
+        bool taken = false;
+        bool taken_yuv = false;
+        double taken_time = 0.0;
+        {
+            // Wakes up regularly to keep handling window events.
+            unique_lock<mutex> lock ( _frame_mutex );
+            _frame_condition.wait_for ( lock, chrono::milliseconds ( 30 ), [this] { return _stopping || _has_pending; } );
+            if ( _stopping )
+            {
+                break;
+            }
+            if ( _has_pending )
+            {
+                // Swaps buffers, so the next offered frame is scaled into the one shown before.
+                swap ( taken_frame, _pending_frame );
+                taken_yuv = _pending_yuv;
+                taken_time = _pending_time;
+                _has_pending = false;
+                taken = true;
+            }
+        }
+        if ( taken )
+        {
+            if ( taken_yuv )
+            {
+                cvtColor ( taken_frame, shown_frame, COLOR_YUV2BGR_I420 );
+            }
+            else
+            {
+                shown_frame = taken_frame;
+            }
+            if ( !window_sized )
+            {
+                resizeWindow ( _window_name, shown_frame.cols, shown_frame.rows );
+                window_sized = true;
+            }
+            setWindowTitle ( _window_name, _window_name + " - time " + to_string ( taken_time ) );
+            imshow ( _window_name, shown_frame );
+        }
+        if ( ( char ) waitKey ( 1 ) == 'q' )
+        {
+            _quit_requested = true;
+        }
+    }
+    destroyWindow ( _window_name );
+}
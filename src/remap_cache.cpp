@@ -0,0 +1,135 @@
+#include "remap_cache.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+
+uint64_t RemapCache::ComputeKey ( const unordered_map<string, Camera>& cameras_map, const Size& output_size,
+                                  const int project_size, const double mesh_tolerance, const WeightStorage weight_storage,
+                                  const ProjectionType projection_type )
+{
+    // Combines camera hashes in name order, so the key doesn't depend on map iteration order.
+    map<string, uint64_t> camera_hashes;
+    for ( const auto& camera_pair : cameras_map )
+    {
+        camera_hashes[camera_pair.first] = camera_pair.second.GetParameterHash();
+    }
+    vector<uint64_t> values = { ( uint64_t ) kVersion, ( uint64_t ) output_size.width, ( uint64_t ) output_size.height,
+                                ( uint64_t ) project_size, ( uint64_t ) weight_storage, ( uint64_t ) projection_type
+                              };
+    values.push_back ( Utils::HashBytes ( &mesh_tolerance, sizeof ( mesh_tolerance ) ) );
+    for ( const auto& hash_pair : camera_hashes )
+    {
+        values.push_back ( hash_pair.second );
+    }
+    return Utils::HashBytes ( values.data(), values.size() * sizeof ( uint64_t ) );
+}
+
+string RemapCache::GetFileName ( const string& folder, const uint64_t key )
+{
+    stringstream file_name_ss;
+    file_name_ss << Utils::EnsureTrailingSlash ( folder ) << "remap_" << hex << setfill ( '0' ) << setw ( 16 ) << key << ".bin";
+    return file_name_ss.str();
+}
+
+bool RemapCache::Load ( const string& file_name, const uint64_t key, const unordered_map<string, Camera>& cameras_map,
+                        const Size& output_size, unordered_map<string, FrameMapper>* frame_mapper_map )
+{
+    int file_descriptor = open ( file_name.c_str(), O_RDONLY );
+    if ( file_descriptor < 0 )
+    {
+        return false;
+    }
+    struct stat file_stat;
+    if ( fstat ( file_descriptor, &file_stat ) != 0 || file_stat.st_size == 0 )
+    {
+        close ( file_descriptor );
+        return false;
+    }
+    // Mapping saves reading file through a stream buffer, but tables are copied out of it: entries follow camera
+    // names of any length and aren't aligned, and the file may be replaced by another run while mappers are used.
+    void* mapped = mmap ( NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, file_descriptor, 0 );
+    close ( file_descriptor );
+    if ( mapped == MAP_FAILED )
+    {
+        return false;
+    }
+
+    const uchar* data = static_cast<const uchar*> ( mapped );
+    const uchar* data_end = data + file_stat.st_size;
+    uint32_t header[3];
+    uint64_t file_key;
+    bool loaded = false;
+    unordered_map<string, FrameMapper> loaded_mappers;
+    if ( data_end - data >= ( ptrdiff_t ) ( sizeof ( header ) + sizeof ( file_key ) ) )
+    {
+        memcpy ( header, data, sizeof ( header ) );
+        memcpy ( &file_key, data + sizeof ( header ), sizeof ( file_key ) );
+        data += sizeof ( header ) + sizeof ( file_key );
+        loaded = header[0] == kMagic && header[1] == kVersion && file_key == key && header[2] == cameras_map.size();
+        // Each mapper is stored with the length of camera name and the name ahead.
+        for ( uint32_t i=0; loaded && i<header[2]; i++ )
+        {
+            uint32_t name_size;
+            if ( data_end - data < ( ptrdiff_t ) sizeof ( name_size ) )
+            {
+                loaded = false;
+                break;
+            }
+            memcpy ( &name_size, data, sizeof ( name_size ) );
+            data += sizeof ( name_size );
+            if ( data_end - data < ( ptrdiff_t ) name_size )
+            {
+                loaded = false;
+                break;
+            }
+            string camera_name ( reinterpret_cast<const char*> ( data ), name_size );
+            data += name_size;
+            // A camera stored twice would leave another camera of the same count without mapper.
+            auto camera_iterator = cameras_map.find ( camera_name );
+            loaded = camera_iterator != cameras_map.end() && loaded_mappers.count ( camera_name ) == 0
+                     && loaded_mappers[camera_name].Read ( camera_iterator->second, &data, data_end )
+                     && loaded_mappers[camera_name].GetOutputSize() == output_size;
+        }
+    }
+    munmap ( mapped, file_stat.st_size );
+
+    if ( loaded )
+    {
+        *frame_mapper_map = loaded_mappers;
+    }
+    return loaded;
+}
+
+bool RemapCache::Save ( const string& file_name, const uint64_t key, const unordered_map<string, FrameMapper>& frame_mapper_map )
+{
+    string temporary_file_name = file_name + "." + to_string ( getpid() ) + ".tmp";
+    ofstream stream ( temporary_file_name, ios::binary | ios::trunc );
+    if ( !stream.is_open() )
+    {
+        return false;
+    }
+    uint32_t header[3] = { kMagic, kVersion, ( uint32_t ) frame_mapper_map.size() };
+    stream.write ( reinterpret_cast<const char*> ( header ), sizeof ( header ) );
+    stream.write ( reinterpret_cast<const char*> ( &key ), sizeof ( key ) );
+    for ( const auto& frame_mapper_pair : frame_mapper_map )
+    {
+        uint32_t name_size = frame_mapper_pair.first.size();
+        stream.write ( reinterpret_cast<const char*> ( &name_size ), sizeof ( name_size ) );
+        stream.write ( frame_mapper_pair.first.data(), name_size );
+        frame_mapper_pair.second.Write ( stream );
+    }
+    stream.close();
+    if ( stream.fail() || rename ( temporary_file_name.c_str(), file_name.c_str() ) != 0 )
+    {
+        remove ( temporary_file_name.c_str() );
+        return false;
+    }
+    return true;
+}
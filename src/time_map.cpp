@@ -0,0 +1,39 @@
+#include "time_map.h"
+
+#include <algorithm>
+
+void TimeMap::AddKnot ( const double global_time, const double shift )
+{
+    CV_Assert ( _knots.empty() || global_time > _knots.back().x );
+    _knots.push_back ( Point2d ( global_time, shift ) );
+}
+
+double TimeMap::GetShift ( const double global_time ) const
+{
+    if ( _knots.empty() )
+    {
+        return 0.0;
+    }
+    // Finds the first knot after global time, so the segment holding it starts at the knot before.
+    auto next_knot = upper_bound ( _knots.begin(), _knots.end(), global_time,
+                                   [] ( const double time, const Point2d& knot ) { return time < knot.x; } );
+    if ( next_knot == _knots.begin() )
+    {
+        return _knots.front().y;
+    }
+    if ( next_knot == _knots.end() )
+    {
+        return _knots.back().y;
+    }
+    const Point2d& previous_knot = * ( next_knot - 1 );
+    double ratio = ( global_time - previous_knot.x ) / ( next_knot->x - previous_knot.x );
+    return previous_knot.y + ratio * ( next_knot->y - previous_knot.y );
+}
+
+void TimeMap::AddOffset ( const double offset )
+{
+    for ( Point2d& knot : _knots )
+    {
+        knot += Point2d ( offset, offset );
+    }
+}
@@ -1,5 +1,7 @@
 #include "include/utils.h"
 
+#include <fstream>
+
 bool Utils::FileExists ( const string& path )
 {
     return boost::filesystem::is_regular_file(path);
@@ -80,6 +82,44 @@ Point3d Utils::GetSpherePointFromScreenPoint ( const Point2d& screen_point, cons
     return Point3d ( x, y, z );
 }
 
+Point2d Utils::GetScreenPointFromSpherePoint ( const Point3d& sphere_point, const Size& canvas_size )
+{
+    double elevation = asin ( max ( -1.0, min ( 1.0, sphere_point.y / cv::norm ( sphere_point ) ) ) );
+    double azimuth = atan2 ( sphere_point.x, sphere_point.z );
+    if ( azimuth < 0.0 )
+    {
+        azimuth += 2 * M_PI;
+    }
+    return Point2d ( azimuth / ( 2 * M_PI ) * canvas_size.width, ( elevation / M_PI + 0.5 ) * canvas_size.height );
+}
+
+uint64_t Utils::HashBytes ( const void* data, const size_t size, const uint64_t hash )
+{
+    const uchar* bytes = static_cast<const uchar*> ( data );
+    uint64_t result = hash;
+    for ( size_t i=0; i<size; i++ )
+    {
+        result ^= bytes[i];
+        result *= 1099511628211ULL;
+    }
+    return result;
+}
+
+uint64_t Utils::HashFileIdentity ( const string& path, const uint64_t hash )
+{
+    uint64_t result = HashBytes ( path.data(), path.size(), hash );
+    boost::system::error_code error;
+    uint64_t file_size = boost::filesystem::file_size ( path, error );
+    int64_t modified_time = boost::filesystem::last_write_time ( path, error );
+    result = HashBytes ( &file_size, sizeof ( file_size ), result );
+    result = HashBytes ( &modified_time, sizeof ( modified_time ), result );
+    // Only the first megabyte is read, which holds container headers and the start of streams.
+    vector<char> leading_bytes ( 1 << 20 );
+    ifstream file ( path, ios::binary );
+    file.read ( leading_bytes.data(), leading_bytes.size() );
+    return HashBytes ( leading_bytes.data(), file.gcount(), result );
+}
+
 double Utils::EvaluatePolyEquation ( const double* coefficients, const int n, const double x )
 {
     double y = 0.0;
@@ -94,3 +134,15 @@ double Utils::EvaluatePolyEquation ( const double* coefficients, const int n, co
 
 
 
+
+double Utils::EvaluatePolyDerivative ( const double* coefficients, const int n, const double x )
+{
+    double y = 0.0;
+    double x_i = 1.0;
+    for ( int power=1; power<n; power++ )
+    {
+        y += power * coefficients[power] * x_i;
+        x_i *= x;
+    }
+    return y;
+}
@@ -1,162 +1,295 @@
 #include "video_clip.h"
 
-bool VideoClip::ExtractAudioSamples ( Mat* mat, const int duration )
+bool VideoClip::ExtractAudioSamples ( Mat* mat, const int duration, const int sample_rate )
 {
-    // Initializes FFmpeg.
-    av_register_all();
-
-    AVFrame* frame = av_frame_alloc();
-    if ( !frame )
+    _audio_stream = make_shared<AudioStream> ();
+    if ( !_audio_stream->Open ( GetDemuxer(), sample_rate ) )
     {
-        cerr << "FFmpeg: Fail to allocate AVFrame." << endl;
-        exit ( -1 );
+        return false;
     }
+    _audio_sample_rate = _audio_stream->GetSampleRate();
+
+    // Resampler writes straight into samples, which hold the whole duration.
+    Mat samples ( 1, duration * _audio_stream->GetSampleRate(), CV_32FC1 );
+    int sample_count = samples.empty() ? 0 : _audio_stream->Read ( samples.ptr<float>(), samples.cols );
+    *mat = samples.colRange ( 0, sample_count );
+    return sample_count != 0;
+}
 
-    AVFormatContext* format_context = NULL;
-    if ( avformat_open_input ( &format_context, _file_name.c_str(), NULL, NULL ) != 0 )
+int VideoClip::ProbeAudioSampleRate()
+{
+    shared_ptr<Demuxer> demuxer = GetDemuxer();
+    int audio_index = demuxer->FindBestStream ( AVMEDIA_TYPE_AUDIO );
+    if ( audio_index < 0 )
     {
-        av_free ( frame );
-        cerr << "FFmpeg: Fail to open file " << _file_name << endl;
-        exit ( -1 );
+        return 0;
     }
+    return demuxer->GetStream ( audio_index )->codecpar->sample_rate;
+}
 
-    // Finds the audio stream.
-    AVCodec* codec = NULL;
-    int stream_index = av_find_best_stream ( format_context, AVMEDIA_TYPE_AUDIO, -1, -1, &codec, 0 );
-    if ( stream_index < 0 )
+void VideoClip::StopKeepingVideoPackets()
+{
+    if ( _demuxer && _demuxer->IsOpened() )
     {
-        av_free ( frame );
-        avformat_close_input ( &format_context );
-        cerr << "FFmpeg: Cannot find any audio stream in the file " << _file_name << endl;
-        exit ( -1 );
+        int video_index = _demuxer->FindBestStream ( AVMEDIA_TYPE_VIDEO );
+        if ( video_index >= 0 )
+        {
+            _demuxer->SetStreamWanted ( video_index, false );
+        }
     }
+}
 
-    AVStream* audio_stream = format_context->streams[stream_index];
-    AVCodecContext* audio_codec_context = audio_stream->codec;
-    audio_codec_context->codec = codec;
-
-    if ( avcodec_open2 ( audio_codec_context, audio_codec_context->codec, NULL ) != 0 )
+void VideoClip::CloseAudio()
+{
+    _audio_stream.reset();
+    // Other backends open file on their own, so demuxer is only kept for FFmpeg decoding.
+    if ( _decode_backend != DECODE_BACKEND_FFMPEG )
     {
-        av_free ( frame );
-        avformat_close_input ( &format_context );
-        cerr << "FFmpeg: Cannot open the context with the decoder" << endl;
-        exit ( -1 );
+        _demuxer.reset();
     }
+}
 
-    int sample_rate = audio_codec_context->sample_rate;
-    _audio_sample_rate = sample_rate;
-    int sample_size = av_get_bytes_per_sample ( audio_codec_context->sample_fmt );
-    int duration_in_sample = duration * sample_rate;
-
-    vector<float> samples;
-
-    AVPacket read_packet;
-    av_init_packet ( &read_packet );
+Mat VideoClip::ReadSynchedFrame ( const double global_time )
+{
+    if ( !IsVideoOpened() )
+    {
+        OpenVideo();
+    }
+    if ( !IsVideoOpened() )
+    {
+        cerr << "Cannot open video file: " << _file_name << endl;
+    }
+    Mat frame;
+    double local_time = GetLocalTime ( global_time );
+    // Returns empty matrix if video has not started yet.
+    if ( local_time < 0.0 )
+    {
+        return frame;
+    }
+    if ( !GrabNearestFrame ( local_time, _read_mode == READ_MODE_SEEK ) )
+    {
+        return frame;
+    }
+    return RetrieveNearestFrame();
+}
 
-    // Reads the packets in a loop.
-    while ( av_read_frame ( format_context, &read_packet ) == 0 )
+bool VideoClip::ReadSynchedFrame ( const double global_time, Mat* frame )
+{
+    if ( !IsVideoOpened() )
+    {
+        OpenVideo();
+    }
+    double local_time = GetLocalTime ( global_time );
+    if ( local_time < 0.0 || !GrabNearestFrame ( local_time, _read_mode == READ_MODE_SEEK ) )
     {
-        if ( read_packet.stream_index == audio_stream->index )
+        return false;
+    }
+    if ( _frame_retrieved )
+    {
+        if ( frame->data != _frame.data )
         {
-            AVPacket decoding_packet = read_packet;
-            bool enough_samples = false;
-            // Audio packets can have multiple audio frames in a single packet
-            while ( decoding_packet.size > 0 )
-            {
-                // Tries to decode the packet into a frame.
-                // Some frames reply on multiple packets, so we have to make sure the frame is finished before we can use it.
-                int got_frame = 0;
-                int result = avcodec_decode_audio4 ( audio_codec_context, frame, &got_frame, &decoding_packet );
-
-                if ( result >= 0 && got_frame )
-                {
-                    decoding_packet.size -= result;
-                    decoding_packet.data += result;
-
-                    // We now have a fully decoded audio frame
-                    CopySamplesToVector ( audio_codec_context, frame, samples );
-                }
-                else
-                {
-                    decoding_packet.size = 0;
-                    decoding_packet.data = NULL;
-                }
-
-                if ( samples.size() >= ( unsigned ) duration_in_sample )
-                {
-                    enough_samples = true;
-                    break;
-                }
-            }
+            _frame.copyTo ( *frame );
+        }
+        return true;
+    }
+    if ( !RetrieveFrame ( frame ) )
+    {
+        return false;
+    }
+    _frame = *frame;
+    _frame_retrieved = true;
+    return true;
+}
 
-            if ( enough_samples )
-            {
-                break;
-            }
+bool VideoClip::ReadSynchedPlanes ( const double global_time, vector<Mat>* planes )
+{
+    planes->clear();
+    if ( !IsVideoOpened() )
+    {
+        OpenVideo();
+    }
+    double local_time = GetLocalTime ( global_time );
+    if ( local_time < 0.0 || !GrabNearestFrame ( local_time, _read_mode == READ_MODE_SEEK ) )
+    {
+        return false;
+    }
+    // Full range frames, as of YUVJ420P, take the BGR path below, which converts them to limited range.
+    const AVFrame* decoded_frame = GetDecodedFrame();
+    if ( decoded_frame && decoded_frame->format == AV_PIX_FMT_YUV420P && decoded_frame->color_range != AVCOL_RANGE_JPEG )
+    {
+        // Wraps decoded planes, keeping their line strides.
+        for ( int p=0; p<3; p++ )
+        {
+            int rows = p == 0 ? decoded_frame->height : ( decoded_frame->height + 1 ) / 2;
+            int cols = p == 0 ? decoded_frame->width : ( decoded_frame->width + 1 ) / 2;
+            planes->push_back ( Mat ( rows, cols, CV_8UC1, decoded_frame->data[p], decoded_frame->linesize[p] ) );
         }
+        return true;
     }
+    // Frames of other decoders, pixel formats or ranges are converted from BGR, to limited range as encoded.
+    Mat frame = RetrieveNearestFrame();
+    if ( frame.empty() || frame.rows % 2 != 0 || frame.cols % 2 != 0 )
+    {
+        return false;
+    }
+    Mat yuv_frame;
+    cvtColor ( frame, yuv_frame, COLOR_BGR2YUV_I420 );
+    int chroma_size = ( frame.rows / 2 ) * ( frame.cols / 2 );
+    planes->push_back ( yuv_frame.rowRange ( 0, frame.rows ) );
+    planes->push_back ( Mat ( frame.rows / 2, frame.cols / 2, CV_8UC1, yuv_frame.ptr ( frame.rows ) ).clone() );
+    planes->push_back ( Mat ( frame.rows / 2, frame.cols / 2, CV_8UC1, yuv_frame.ptr ( frame.rows ) + chroma_size ).clone() );
+    return true;
+}
 
-    // av_free_packet() must be called after each call to av_read_frame() or memory will leak.
-    av_free_packet ( &read_packet );
+bool VideoClip::HasFinished ( const double global_time )
+{
+    double local_time = GetLocalTime ( global_time );
+    if ( local_time < 0.0 )
+    {
+        return false;
+    }
+    return !IsVideoOpened() || ( _end_of_stream && ( !_has_grabbed || local_time > _grabbed_time + _frame_interval ) );
+}
 
-    // Some codecs will cause frames to be buffered up in the decoding process.
-    // If the CODEC_CAP_DELAY flag is set, there can be buffered up frames that need to be flushed.
-    // So we'll do that here
-    if ( audio_codec_context->codec->capabilities & CODEC_CAP_DELAY )
+bool VideoClip::GrabNearestFrame ( const double local_time, const bool force_seek )
+{
+    const double half_interval = _frame_interval / 2.0;
+    // Seeks only when time goes back before the grabbed frame, or too far ahead to decode through.
+    bool seek = force_seek || ( _has_grabbed ? local_time < _grabbed_time - half_interval || local_time > _grabbed_time + _max_forward_gap
+                                : local_time > _max_forward_gap );
+    if ( seek )
+    {
+        SeekFrame ( max ( local_time - half_interval, 0.0 ) );
+        _has_grabbed = false;
+        _end_of_stream = false;
+    }
+    if ( !_has_grabbed && !_end_of_stream )
     {
-        av_init_packet ( &read_packet );
-        // Decode all the remaining frames in the buffer, until the end is reached
-        int got_frame = 0;
-        while ( avcodec_decode_audio4 ( audio_codec_context, frame, &got_frame, &read_packet ) >= 0 && got_frame )
+        _end_of_stream = !GrabFrame();
+        _has_grabbed = !_end_of_stream;
+        _frame_retrieved = false;
+    }
+    // Grabs without color conversion while the next frame is nearer to local time, so sources of
+    // higher frame rate skip frames and sources of lower frame rate repeat them.
+    while ( _has_grabbed && !_end_of_stream && _grabbed_time + _frame_interval <= local_time + half_interval )
+    {
+        if ( !GrabFrame() )
         {
-            // We now have a fully decoded audio frame
-            CopySamplesToVector ( audio_codec_context, frame, samples );
+            _end_of_stream = true;
+            break;
         }
+        _frame_retrieved = false;
     }
+    // Returns false if video has finished.
+    return _has_grabbed && !( _end_of_stream && local_time > _grabbed_time + _frame_interval );
+}
 
-    // Cleans everything.
-    av_free ( frame );
-    avcodec_close ( audio_codec_context );
-    avformat_close_input ( &format_context );
-
-    // Copy vector to mat
-    *mat = cv::Mat::zeros ( 1, samples.size(), CV_32FC1 );
-    memcpy ( mat->data, samples.data(), samples.size() * sample_size );
+Mat VideoClip::RetrieveNearestFrame()
+{
+    if ( !_frame_retrieved )
+    {
+        // Retrieves into a new matrix, so frames returned earlier are never overwritten.
+        _frame = Mat();
+        if ( !RetrieveFrame ( &_frame ) )
+        {
+            return Mat();
+        }
+        _frame_retrieved = true;
+    }
+    return _frame;
+}
 
-    return samples.size() != 0;
+shared_ptr<Demuxer> VideoClip::GetDemuxer()
+{
+    if ( !_demuxer )
+    {
+        _demuxer = make_shared<Demuxer> ();
+        if ( _demuxer->Open ( _file_name ) && _decode_backend == DECODE_BACKEND_FFMPEG )
+        {
+            // Video packets are kept from the start, as video is decoded from the same demuxer after audio.
+            int video_index = _demuxer->FindBestStream ( AVMEDIA_TYPE_VIDEO );
+            if ( video_index >= 0 )
+            {
+                _demuxer->SetStreamWanted ( video_index, true );
+            }
+        }
+    }
+    return _demuxer;
 }
 
-Mat VideoClip::ReadSynchedFrame ( const double global_time )
+void VideoClip::OpenVideo()
 {
-    if ( &_video_capture == NULL || !_video_capture.isOpened() )
+    double fps = 0.0;
+    if ( _decode_backend == DECODE_BACKEND_FFMPEG )
+    {
+        _video_decoder = make_shared<VideoDecoder> ();
+        _video_decoder->Open ( GetDemuxer(), _decode_thread_count );
+        _frame_size = _video_decoder->GetFrameSize();
+        fps = _video_decoder->GetFrameRate();
+    }
+    else
     {
         _video_capture = VideoCapture ( _file_name );
         _frame_size = Size ( _video_capture.get ( CV_CAP_PROP_FRAME_WIDTH ), _video_capture.get ( CV_CAP_PROP_FRAME_HEIGHT ) );
+        fps = _video_capture.get ( CV_CAP_PROP_FPS );
     }
-    if ( !_video_capture.isOpened() )
+    _frame_interval = fps > 0.0 ? 1.0 / fps : 1.0 / 30;
+    _has_grabbed = false;
+    _end_of_stream = false;
+}
+
+bool VideoClip::IsVideoOpened()
+{
+    if ( _decode_backend == DECODE_BACKEND_FFMPEG )
     {
-        cerr << "Cannot open video file: " << _file_name << endl;
+        return _video_decoder && _video_decoder->IsOpened();
     }
-    Mat frame;
-    double local_time = global_time - _shift_in_seconds;
-    // Returns empty matrix if video has not started yet.
-    if ( local_time < 0.0 )
+    return _video_capture.isOpened();
+}
+
+bool VideoClip::GrabFrame()
+{
+    if ( _decode_backend == DECODE_BACKEND_FFMPEG )
     {
-        return frame;
+        if ( !_video_decoder || !_video_decoder->Grab() )
+        {
+            return false;
+        }
+        _grabbed_time = _video_decoder->GetTimestamp();
+        return true;
     }
-    _video_capture.set ( CV_CAP_PROP_POS_MSEC, local_time * 1000.0 );
-    // Returns empty matrix if video has finished.
-    if ( !_video_capture.read ( frame ) )
+    if ( !_video_capture.grab() )
     {
-        return frame;
+        return false;
     }
+    // Position read after grab is taken as the time of the grabbed frame, as OpenCV's FFmpeg backend reports it.
+    // Other backends may report the next frame, off by one frame interval, or no position at all. Positions not
+    // moving forward since the last frame grabbed are replaced by the time one frame interval later, so
+    // sequential reads still move forward.
+    double position = _video_capture.get ( CV_CAP_PROP_POS_MSEC ) / 1000.0;
+    _grabbed_time = _has_grabbed && !( position > _grabbed_time ) ? _grabbed_time + _frame_interval : position;
+    return true;
+}
 
-    return frame;
+void VideoClip::SeekFrame ( const double seconds )
+{
+    // FFmpeg seeks to the previous key frame, and frames up to the time are then decoded forward.
+    if ( _decode_backend == DECODE_BACKEND_FFMPEG )
+    {
+        if ( _video_decoder )
+        {
+            _video_decoder->Seek ( seconds );
+        }
+        return;
+    }
+    _video_capture.set ( CV_CAP_PROP_POS_MSEC, seconds * 1000.0 );
 }
 
-void VideoClip::CopySamplesToVector ( const AVCodecContext* codec_context, const AVFrame* frame, vector< float >& samples )
+bool VideoClip::RetrieveFrame ( Mat* frame )
 {
-    float* data_begin = reinterpret_cast<float*> ( frame->data[0] );
-    ulong size = frame->nb_samples * av_get_bytes_per_sample ( codec_context->sample_fmt ) / sizeof ( float );
-    samples.insert ( samples.end(), data_begin, data_begin + size );
+    if ( _decode_backend == DECODE_BACKEND_FFMPEG )
+    {
+        return _video_decoder && _video_decoder->Retrieve ( frame );
+    }
+    return _video_capture.retrieve ( *frame );
 }
@@ -0,0 +1,159 @@
+#include "video_decoder.h"
+
+VideoDecoder::~VideoDecoder()
+{
+    Close();
+}
+
+bool VideoDecoder::Open ( const shared_ptr<Demuxer>& demuxer, const int thread_count, const int thread_type )
+{
+    Close();
+    if ( !demuxer || !demuxer->IsOpened() )
+    {
+        return false;
+    }
+    AVCodec* codec = NULL;
+    int stream_index = demuxer->FindBestStream ( AVMEDIA_TYPE_VIDEO, &codec );
+    if ( stream_index < 0 )
+    {
+        cerr << "FFmpeg: Cannot find any video stream in the file" << endl;
+        return false;
+    }
+    _demuxer = demuxer;
+    _stream_index = stream_index;
+    _demuxer->SetStreamWanted ( _stream_index, true );
+    _codec_context = avcodec_alloc_context3 ( codec );
+    if ( !_codec_context || avcodec_parameters_to_context ( _codec_context, _demuxer->GetStream ( _stream_index )->codecpar ) < 0 )
+    {
+        cerr << "FFmpeg: Cannot create video decoder context" << endl;
+        Close();
+        return false;
+    }
+    _codec_context->thread_count = thread_count;
+    _codec_context->thread_type = thread_type;
+    if ( avcodec_open2 ( _codec_context, codec, NULL ) != 0 )
+    {
+        cerr << "FFmpeg: Cannot open the context with the decoder" << endl;
+        Close();
+        return false;
+    }
+    _frame = av_frame_alloc();
+    _decoding_frame = av_frame_alloc();
+    _packet = av_packet_alloc();
+    if ( !_frame || !_decoding_frame || !_packet )
+    {
+        cerr << "FFmpeg: Fail to allocate AVFrame." << endl;
+        Close();
+        return false;
+    }
+    _draining = false;
+    return true;
+}
+
+void VideoDecoder::Close()
+{
+    sws_freeContext ( _sws_context );
+    _sws_context = NULL;
+    av_packet_free ( &_packet );
+    av_frame_free ( &_frame );
+    av_frame_free ( &_decoding_frame );
+    avcodec_free_context ( &_codec_context );
+    if ( _demuxer && _stream_index >= 0 )
+    {
+        _demuxer->SetStreamWanted ( _stream_index, false );
+    }
+    _demuxer.reset();
+    _stream_index = -1;
+}
+
+bool VideoDecoder::Grab()
+{
+    if ( !IsOpened() )
+    {
+        return false;
+    }
+    AVStream* stream = _demuxer->GetStream ( _stream_index );
+    while ( true )
+    {
+        // Grabbed frame is kept when decoding fails at the end of stream.
+        int result = avcodec_receive_frame ( _codec_context, _decoding_frame );
+        if ( result == 0 )
+        {
+            av_frame_unref ( _frame );
+            av_frame_move_ref ( _frame, _decoding_frame );
+            int64_t pts = _frame->best_effort_timestamp != AV_NOPTS_VALUE ? _frame->best_effort_timestamp : _frame->pts;
+            int64_t start_time = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+            _timestamp = pts != AV_NOPTS_VALUE ? ( pts - start_time ) * av_q2d ( stream->time_base ) : _timestamp;
+            return true;
+        }
+        if ( result != AVERROR ( EAGAIN ) || _draining )
+        {
+            return false;
+        }
+        // Feeds decoder with the next packet of video stream, or drains it at the end of file.
+        if ( !_demuxer->ReadPacket ( _stream_index, _packet ) )
+        {
+            avcodec_send_packet ( _codec_context, NULL );
+            _draining = true;
+            continue;
+        }
+        avcodec_send_packet ( _codec_context, _packet );
+        av_packet_unref ( _packet );
+    }
+}
+
+bool VideoDecoder::Retrieve ( Mat* frame )
+{
+    if ( !IsOpened() || _frame->width <= 0 || _frame->height <= 0 )
+    {
+        return false;
+    }
+    _sws_context = sws_getCachedContext ( _sws_context, _frame->width, _frame->height, ( AVPixelFormat ) _frame->format,
+                                          _frame->width, _frame->height, AV_PIX_FMT_BGR24, SWS_BILINEAR, NULL, NULL, NULL );
+    if ( !_sws_context )
+    {
+        return false;
+    }
+    // Scaler only infers full range from YUVJ formats, so it is set for frames of other formats tagged so.
+    if ( _frame->color_range == AVCOL_RANGE_JPEG )
+    {
+        const int* coefficients = sws_getCoefficients ( SWS_CS_DEFAULT );
+        sws_setColorspaceDetails ( _sws_context, coefficients, 1, coefficients, 1, 0, 1 << 16, 1 << 16 );
+    }
+    frame->create ( _frame->height, _frame->width, CV_8UC3 );
+    // Scaler reads four plane pointers and strides, so unused planes are padded.
+    uint8_t* destination[4] = { frame->data, NULL, NULL, NULL };
+    int destination_stride[4] = { ( int ) frame->step, 0, 0, 0 };
+    sws_scale ( _sws_context, _frame->data, _frame->linesize, 0, _frame->height, destination, destination_stride );
+    return true;
+}
+
+bool VideoDecoder::Seek ( const double seconds )
+{
+    if ( !IsOpened() )
+    {
+        return false;
+    }
+    if ( !_demuxer->Seek ( _stream_index, seconds ) )
+    {
+        return false;
+    }
+    avcodec_flush_buffers ( _codec_context );
+    _draining = false;
+    return true;
+}
+
+double VideoDecoder::GetFrameRate() const
+{
+    if ( !IsOpened() )
+    {
+        return 0.0;
+    }
+    AVRational frame_rate = av_guess_frame_rate ( _demuxer->GetFormatContext(), _demuxer->GetStream ( _stream_index ), NULL );
+    return frame_rate.den > 0 ? av_q2d ( frame_rate ) : 0.0;
+}
+
+Size VideoDecoder::GetFrameSize() const
+{
+    return IsOpened() ? Size ( _codec_context->width, _codec_context->height ) : Size();
+}
@@ -0,0 +1,210 @@
+#include "video_encoder.h"
+
+VideoEncoder::~VideoEncoder()
+{
+    Close();
+}
+
+bool VideoEncoder::Open ( const string& file_name, const Size& frame_size, const double fps, const EncoderSettings& settings )
+{
+    Close();
+#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT ( 58, 9, 100 )
+    av_register_all();
+#endif
+    if ( avformat_alloc_output_context2 ( &_format_context, NULL, NULL, file_name.c_str() ) < 0 || !_format_context )
+    {
+        cerr << "FFmpeg: Cannot guess output format of file " << file_name << endl;
+        return false;
+    }
+    AVCodec* codec = avcodec_find_encoder_by_name ( settings.codec_name.c_str() );
+    if ( !codec )
+    {
+        cerr << "FFmpeg: Encoder " << settings.codec_name << " is not available, falling back to mpeg4." << endl;
+        codec = avcodec_find_encoder ( AV_CODEC_ID_MPEG4 );
+    }
+    _stream = codec ? avformat_new_stream ( _format_context, NULL ) : NULL;
+    _codec_context = _stream ? avcodec_alloc_context3 ( codec ) : NULL;
+    if ( !_codec_context )
+    {
+        cerr << "FFmpeg: Cannot create encoder context for " << file_name << endl;
+        Close();
+        return false;
+    }
+    AVRational frame_rate = av_d2q ( fps, 100000 );
+    _codec_context->width = frame_size.width;
+    _codec_context->height = frame_size.height;
+    _codec_context->pix_fmt = AV_PIX_FMT_YUV420P;
+    // Stitched planes and frames converted by swscale and OpenCV are all limited range.
+    _codec_context->color_range = AVCOL_RANGE_MPEG;
+    _codec_context->framerate = frame_rate;
+    _codec_context->time_base = av_inv_q ( frame_rate );
+    _codec_context->gop_size = settings.gop_size;
+    _codec_context->thread_count = settings.thread_count;
+    if ( _format_context->oformat->flags & AVFMT_GLOBALHEADER )
+    {
+        _codec_context->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+    // Presets and CRF are private options of encoders like x264 and x265, set only where they exist.
+    if ( !settings.preset.empty() && av_opt_find ( _codec_context->priv_data, "preset", NULL, 0, 0 ) )
+    {
+        av_opt_set ( _codec_context->priv_data, "preset", settings.preset.c_str(), 0 );
+    }
+    if ( settings.bit_rate > 0 )
+    {
+        _codec_context->bit_rate = settings.bit_rate;
+    }
+    else if ( av_opt_find ( _codec_context->priv_data, "crf", NULL, 0, 0 ) )
+    {
+        av_opt_set_int ( _codec_context->priv_data, "crf", settings.crf, 0 );
+    }
+    else
+    {
+        _codec_context->flags |= AV_CODEC_FLAG_QSCALE;
+        _codec_context->global_quality = FF_QP2LAMBDA * kFallbackQuantizer;
+    }
+    if ( avcodec_open2 ( _codec_context, codec, NULL ) != 0 )
+    {
+        cerr << "FFmpeg: Cannot open encoder " << codec->name << endl;
+        Close();
+        return false;
+    }
+    _stream->time_base = _codec_context->time_base;
+    _stream->avg_frame_rate = frame_rate;
+    if ( avcodec_parameters_from_context ( _stream->codecpar, _codec_context ) < 0 )
+    {
+        cerr << "FFmpeg: Cannot set stream parameters of " << file_name << endl;
+        Close();
+        return false;
+    }
+    if ( !( _format_context->oformat->flags & AVFMT_NOFILE ) && avio_open ( &_format_context->pb, file_name.c_str(), AVIO_FLAG_WRITE ) < 0 )
+    {
+        cerr << "FFmpeg: Fail to create file " << file_name << endl;
+        Close();
+        return false;
+    }
+    if ( avformat_write_header ( _format_context, NULL ) < 0 )
+    {
+        cerr << "FFmpeg: Fail to write header of " << file_name << endl;
+        Close();
+        return false;
+    }
+    _frame = av_frame_alloc();
+    _packet = av_packet_alloc();
+    if ( !_frame || !_packet )
+    {
+        cerr << "FFmpeg: Fail to allocate AVFrame." << endl;
+        Close();
+        return false;
+    }
+    _frame->format = _codec_context->pix_fmt;
+    _frame->width = frame_size.width;
+    _frame->height = frame_size.height;
+    if ( av_frame_get_buffer ( _frame, 32 ) < 0 )
+    {
+        cerr << "FFmpeg: Fail to allocate frame buffer." << endl;
+        Close();
+        return false;
+    }
+    _next_pts = 0;
+    return true;
+}
+
+void VideoEncoder::Close()
+{
+    // Trailer is written only if header was, which is when frame has been allocated.
+    if ( _frame && _packet )
+    {
+        Encode ( NULL );
+        av_write_trailer ( _format_context );
+    }
+    sws_freeContext ( _sws_context );
+    _sws_context = NULL;
+    av_packet_free ( &_packet );
+    av_frame_free ( &_frame );
+    avcodec_free_context ( &_codec_context );
+    if ( _format_context && !( _format_context->oformat->flags & AVFMT_NOFILE ) )
+    {
+        avio_closep ( &_format_context->pb );
+    }
+    avformat_free_context ( _format_context );
+    _format_context = NULL;
+    _stream = NULL;
+}
+
+bool VideoEncoder::Write ( const Mat& frame )
+{
+    if ( !IsOpened() || !_frame || frame.type() != CV_8UC3 || frame.cols != _frame->width || frame.rows != _frame->height )
+    {
+        return false;
+    }
+    // Encoder may still hold the last frame's buffer, in which case a new one is allocated.
+    if ( av_frame_make_writable ( _frame ) < 0 )
+    {
+        return false;
+    }
+    _sws_context = sws_getCachedContext ( _sws_context, frame.cols, frame.rows, AV_PIX_FMT_BGR24,
+                                          frame.cols, frame.rows, AV_PIX_FMT_YUV420P, SWS_BILINEAR, NULL, NULL, NULL );
+    if ( !_sws_context )
+    {
+        return false;
+    }
+    // Scaler reads four plane pointers and strides, so unused planes are padded.
+    const uint8_t* source[4] = { frame.data, NULL, NULL, NULL };
+    int source_stride[4] = { ( int ) frame.step, 0, 0, 0 };
+    sws_scale ( _sws_context, source, source_stride, 0, frame.rows, _frame->data, _frame->linesize );
+    _frame->pts = _next_pts++;
+    return Encode ( _frame );
+}
+
+bool VideoEncoder::WritePlanes ( const Mat planes[3] )
+{
+    if ( !IsOpened() || !_frame || av_frame_make_writable ( _frame ) < 0 )
+    {
+        return false;
+    }
+    for ( int p=0; p<3; p++ )
+    {
+        int rows = p == 0 ? _frame->height : ( _frame->height + 1 ) / 2;
+        int cols = p == 0 ? _frame->width : ( _frame->width + 1 ) / 2;
+        if ( planes[p].type() != CV_8UC1 || planes[p].rows != rows || planes[p].cols != cols )
+        {
+            return false;
+        }
+        Mat frame_plane ( rows, cols, CV_8UC1, _frame->data[p], _frame->linesize[p] );
+        planes[p].copyTo ( frame_plane );
+    }
+    _frame->pts = _next_pts++;
+    return Encode ( _frame );
+}
+
+string VideoEncoder::GetCodecName() const
+{
+    return IsOpened() && _codec_context->codec ? _codec_context->codec->name : "";
+}
+
+bool VideoEncoder::Encode ( AVFrame* frame )
+{
+    if ( avcodec_send_frame ( _codec_context, frame ) < 0 )
+    {
+        return false;
+    }
+    while ( true )
+    {
+        int result = avcodec_receive_packet ( _codec_context, _packet );
+        if ( result == AVERROR ( EAGAIN ) || result == AVERROR_EOF )
+        {
+            return true;
+        }
+        if ( result < 0 )
+        {
+            return false;
+        }
+        av_packet_rescale_ts ( _packet, _codec_context->time_base, _stream->time_base );
+        _packet->stream_index = _stream->index;
+        // Muxer takes ownership of packet data and leaves packet blank.
+        if ( av_interleaved_write_frame ( _format_context, _packet ) < 0 )
+        {
+            return false;
+        }
+    }
+}
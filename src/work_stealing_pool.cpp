@@ -0,0 +1,161 @@
+#include "work_stealing_pool.h"
+
+WorkStealingPool::WorkStealingPool ( const int thread_count )
+    : _thread_count ( thread_count ), _remaining_tasks ( 0 )
+{
+    if ( _thread_count <= 0 )
+    {
+        _thread_count = max ( 1u, thread::hardware_concurrency() );
+    }
+    for ( int i=0; i<_thread_count; i++ )
+    {
+        _queues.emplace_back ( new TaskQueue() );
+    }
+    // The calling thread works as worker 0.
+    for ( int i=1; i<_thread_count; i++ )
+    {
+        _threads.emplace_back ( &WorkStealingPool::WorkerLoop, this, i );
+    }
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    {
+        lock_guard<mutex> lock ( _state_mutex );
+        _stopping = true;
+    }
+    _start_condition.notify_all();
+    for ( thread& worker : _threads )
+    {
+        worker.join();
+    }
+}
+
+void WorkStealingPool::ParallelFor ( const int task_count, const function<void ( int ) >& task )
+{
+    if ( task_count <= 0 )
+    {
+        return;
+    }
+    if ( _thread_count == 1 )
+    {
+        for ( int i=0; i<task_count; i++ )
+        {
+            task ( i );
+        }
+        return;
+    }
+    {
+        lock_guard<mutex> lock ( _state_mutex );
+        for ( int i=0; i<_thread_count; i++ )
+        {
+            lock_guard<mutex> queue_lock ( _queues[i]->queue_mutex );
+            int block_begin = ( long ) task_count * i / _thread_count;
+            int block_end = ( long ) task_count * ( i+1 ) / _thread_count;
+            // Own tasks are popped from the back, so pushes block in reverse order to run it front to back.
+            for ( int j=block_end-1; j>=block_begin; j-- )
+            {
+                _queues[i]->tasks.push_back ( j );
+            }
+        }
+        _task = &task;
+        _remaining_tasks = task_count;
+        _running_workers = _thread_count - 1;
+        _round++;
+    }
+    _start_condition.notify_all();
+
+    RunTasks ( 0, task );
+
+    unique_lock<mutex> lock ( _state_mutex );
+    _done_condition.wait ( lock, [this] { return _remaining_tasks == 0 && _running_workers == 0; } );
+    _task = nullptr;
+    exception_ptr task_exception = _task_exception;
+    _task_exception = nullptr;
+    lock.unlock();
+    if ( task_exception )
+    {
+        rethrow_exception ( task_exception );
+    }
+}
+
+void WorkStealingPool::WorkerLoop ( const int worker_index )
+{
+    long finished_round = 0;
+    while ( true )
+    {
+        const function<void ( int ) >* task = nullptr;
+        {
+            unique_lock<mutex> lock ( _state_mutex );
+            _start_condition.wait ( lock, [&] { return _stopping || _round != finished_round; } );
+            if ( _stopping )
+            {
+                return;
+            }
+            finished_round = _round;
+            task = _task;
+        }
+        RunTasks ( worker_index, *task );
+        {
+            lock_guard<mutex> lock ( _state_mutex );
+            _running_workers--;
+        }
+        _done_condition.notify_all();
+    }
+}
+
+void WorkStealingPool::RunTasks ( const int worker_index, const function<void ( int ) >& task )
+{
+    int task_index;
+    while ( PopTask ( worker_index, &task_index ) || StealTask ( worker_index, &task_index ) )
+    {
+        // An exception escaping a worker thread would terminate the process without a message, so it is
+        // kept for the calling thread.
+        try
+        {
+            task ( task_index );
+        }
+        catch ( ... )
+        {
+            lock_guard<mutex> lock ( _state_mutex );
+            if ( !_task_exception )
+            {
+                _task_exception = current_exception();
+            }
+        }
+        if ( --_remaining_tasks == 0 )
+        {
+            lock_guard<mutex> lock ( _state_mutex );
+            _done_condition.notify_all();
+        }
+    }
+}
+
+bool WorkStealingPool::PopTask ( const int worker_index, int* task_index )
+{
+    TaskQueue* queue = _queues[worker_index].get();
+    lock_guard<mutex> lock ( queue->queue_mutex );
+    if ( queue->tasks.empty() )
+    {
+        return false;
+    }
+    *task_index = queue->tasks.back();
+    queue->tasks.pop_back();
+    return true;
+}
+
+bool WorkStealingPool::StealTask ( const int worker_index, int* task_index )
+{
+    for ( int offset=1; offset<_thread_count; offset++ )
+    {
+        TaskQueue* queue = _queues[ ( worker_index + offset ) % _thread_count].get();
+        lock_guard<mutex> lock ( queue->queue_mutex );
+        if ( !queue->tasks.empty() )
+        {
+            *task_index = queue->tasks.front();
+            queue->tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}